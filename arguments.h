@@ -2,9 +2,12 @@
 #define ARGUMENTS_H
 
 #include <vector>
+#include <array>
 #include <functional>
 
 #include "function_traits.h"
+#include "metasymbol.h"
+#include "metatype.h"
 
 //////////////////////////////////////////////////////////////////////////////////////
 ///
@@ -12,80 +15,221 @@
 namespace arguments
 {
 
+// the type of an argument packed into 32 bits: the dense MetaType id of the type in the low
+// 24 bits, and the qualifier flags in the high bits
 struct ArgumentType
 {
-    type_index m_type;
-    bool m_isConst:1;
-    bool m_isRef:1;
+    enum : uint32_t {
+        TypeIdMask = 0x00ffffff,
+        Const = 0x01000000,
+        Ref = 0x02000000,
+        Pointer = 0x04000000,
+        RValue = 0x08000000
+    };
+    uint32_t m_value = MetaType::Undefined;
 
-    ArgumentType()
-        : m_type(typeid(void))
-        , m_isConst(false)
-        , m_isRef(false)
-    {}
-    ArgumentType(const ArgumentType &other)
-        : m_type(other.m_type)
-        , m_isConst(other.m_isConst)
-        , m_isRef(other.m_isRef)
-    {}
-    ArgumentType(const type_index &type, bool isConst, bool isRef)
-        : m_type(type)
-        , m_isConst(isConst)
-        , m_isRef(isRef)
+    constexpr ArgumentType() = default;
+    constexpr ArgumentType(int typeId, bool isConst, bool isRef, bool isPointer = false, bool isRValue = false)
+        : m_value((uint32_t(typeId) & TypeIdMask)
+                  | (isConst ? uint32_t(Const) : 0u)
+                  | (isRef ? uint32_t(Ref) : 0u)
+                  | (isPointer ? uint32_t(Pointer) : 0u)
+                  | (isRValue ? uint32_t(RValue) : 0u))
     {}
 
+    // a constant for the built-in types
     template<typename Type>
-    static ArgumentType &&value()
+    static constexpr ArgumentType value()
     {
-        return move( ArgumentType{
-                         typeid(Type),
-                         is_const<typename remove_reference<Type>::type>::value,
-                         is_reference<typename remove_const<Type>::type>::value
-                     });
+        typedef typename remove_reference<Type>::type NoRef;
+        return ArgumentType{
+                    MetaType::typeId<Type>(),
+                    is_const<NoRef>::value,
+                    is_reference<Type>::value,
+                    is_pointer<typename remove_cv<NoRef>::type>::value,
+                    is_rvalue_reference<Type>::value
+               };
     }
 
-    bool operator ==(const ArgumentType &that) const
+    constexpr int typeId() const
     {
-        return (m_type == that.m_type)
-               && (m_isRef == that.m_isRef)
-               && (m_isConst == that.m_isConst);
+        return int(m_value & TypeIdMask);
+    }
+    constexpr bool isConst() const
+    {
+        return m_value & Const;
+    }
+    constexpr bool isRef() const
+    {
+        return m_value & Ref;
+    }
+    constexpr bool isPointer() const
+    {
+        return m_value & Pointer;
+    }
+    constexpr bool isRValue() const
+    {
+        return m_value & RValue;
+    }
+
+    // for diagnostics
+    type_index type() const
+    {
+        return MetaType::typeIndex(typeId());
+    }
+
+    constexpr bool operator ==(const ArgumentType &that) const
+    {
+        return m_value == that.m_value;
     }
 
     bool isCompatible(const ArgumentType &invoked) const
     {
-        if (m_type != invoked.m_type) {
+        if (typeId() != invoked.typeId()) {
+            return false;
+        }
+        if (!isRef() && (invoked.isConst() || (invoked.isRef() && !invoked.isRValue()))) {
+            // the lvalues and the const values are copied into the by-value parameters
+            return MetaType::info(typeId()).copy != nullptr;
+        }
+        if (isRef() && !isConst() && invoked.isConst()) {
             return false;
         }
-        if (m_isRef && m_isRef != invoked.m_isRef) {
-            // non-reference invokes are allowed only if the declaration is const
-            return m_isConst;
+        if (isRef() && !invoked.isRef()) {
+            // the rvalues bind to const and to rvalue references
+            return isConst() || isRValue();
         }
-        return true;
+        // the lvalues do not bind to rvalue references
+        return !isRValue() || invoked.isRValue();
+    }
+};
+static_assert(sizeof(ArgumentType) == 4, "ArgumentType must fit in 32 bits");
+
+
+typedef const ArgumentType *ArgIterator;
+
+// hash of a type including its const and reference qualifiers, computed at compile time
+// from the name the compiler generates for the function instance
+template<typename Type>
+constexpr uint64_t typeHash()
+{
+#if defined(_MSC_VER)
+    return MetaSymbol::hash(__FUNCSIG__);
+#else
+    return MetaSymbol::hash(__PRETTY_FUNCTION__);
+#endif
+}
+
+constexpr uint64_t combineHash(uint64_t seed, uint64_t hash)
+{
+    return (seed ^ hash) * 1099511628211ull;
+}
+
+template<typename... Types>
+constexpr uint64_t typeListHash()
+{
+    uint64_t hash = 14695981039346656037ull;
+    ((hash = combineHash(hash, typeHash<Types>())), ...);
+    return hash;
+}
+
+// the hash of a method signature, a single integer compare tells whether two signatures match
+template<typename TReturnType, typename... Arguments>
+constexpr uint64_t signatureHash()
+{
+    return combineHash(typeHash<TReturnType>(), typeListHash<Arguments...>());
+}
+
+// view over the argument types of a signature; the types themselves are stored in
+// read-only static arrays, one for each signature, so the view is never allocating
+class ArgContainer
+{
+    ArgIterator m_begin = nullptr;
+    size_t m_size = 0;
+    uint64_t m_hash = 0;
+
+public:
+    constexpr ArgContainer() = default;
+    constexpr ArgContainer(ArgIterator begin, size_t size, uint64_t hash)
+        : m_begin(begin)
+        , m_size(size)
+        , m_hash(hash)
+    {
+    }
+
+    constexpr ArgIterator begin() const
+    {
+        return m_begin;
+    }
+    constexpr ArgIterator end() const
+    {
+        return m_begin + m_size;
+    }
+    constexpr ArgIterator cbegin() const
+    {
+        return begin();
+    }
+    constexpr ArgIterator cend() const
+    {
+        return end();
+    }
+    constexpr size_t size() const
+    {
+        return m_size;
+    }
+    constexpr const ArgumentType &operator[](size_t index) const
+    {
+        return m_begin[index];
+    }
+    // the typeListHash() of the types
+    constexpr uint64_t hash() const
+    {
+        return m_hash;
+    }
+
+    bool operator ==(const ArgContainer &that) const
+    {
+        return (m_begin == that.m_begin && m_size == that.m_size)
+               || equal(begin(), end(), that.begin(), that.end());
     }
 };
 
-typedef vector<ArgumentType> ArgContainer;
-typedef ArgContainer::const_iterator ArgIterator;
+template<typename... Types>
+struct Signature
+{
+    // the type ids of the non built-in types are assigned at runtime, so the array of a
+    // signature with such types is initialized dynamically, unordered with the other static
+    // initializers; its address is still a constant. The arrays of the built-in types are
+    // constant initialized. Do not make the typed invokes involving registered types from
+    // the static initializers, as with MetaType::id
+    static inline const array<ArgumentType, sizeof... (Types)> types = { ArgumentType::value<Types>()... };
+    static constexpr uint64_t hash = typeListHash<Types...>();
+};
+
+// the argument types of the given type list
+template<typename... Types>
+constexpr ArgContainer signature()
+{
+    return ArgContainer(Signature<Types...>::types.data(), sizeof... (Types), Signature<Types...>::hash);
+}
 
 template<typename... Arguments>
-static constexpr arguments::ArgContainer argumentTypes(Arguments && ...args)
+constexpr ArgContainer argumentTypes(Arguments && ...)
 {
-    array<arguments::ArgumentType, sizeof... (Arguments)> aa = { arguments::ArgumentType::value<Arguments>()... };
-    return arguments::ArgContainer(aa.begin(), aa.end());
+    return signature<Arguments...>();
 }
 
 // extracts the return type and the arguments of a given method
 template<class TClass, typename TReturnType, typename... Arguments>
-static constexpr arguments::ArgContainer argumentTypes(TReturnType (TClass::*)(Arguments...))
+constexpr ArgContainer argumentTypes(TReturnType (TClass::*)(Arguments...))
 {
-    const array<arguments::ArgumentType, sizeof... (Arguments) + 1> aa =
-            { arguments::ArgumentType::value<TReturnType>(), arguments::ArgumentType::value<Arguments>()... };
-    return arguments::ArgContainer(aa.begin(), aa.end());
+    return signature<TReturnType, Arguments...>();
 }
 
 } // namespace arguments
 
-// generic argument holding values in variants
+// untyped argument, pointing to the value and describing its type; the arguments are
+// passed in spans, so the derived classes add no data
 class ArgumentBase
 {
 protected:
@@ -97,7 +241,6 @@ public:
         : m_name(name)
         , m_data(data)
     {}
-    virtual ~ArgumentBase() {}
     inline bool isValid() const
     {
         return m_name != nullptr;
@@ -131,10 +274,11 @@ template<class T>
 class Argument : public ArgumentBase
 {
 public:
-    inline Argument(const char *name, T &data)
+    inline Argument(const char *name, const T &data)
         : ArgumentBase(name, static_cast<const void*>(&data))
     {
-        m_type = arguments::ArgumentType::value<T>();
+        // the value is only read, it does not bind to non-const and rvalue references
+        m_type = arguments::ArgumentType::value<const T&>();
     }
 };
 
@@ -145,12 +289,12 @@ public:
     inline Argument(const char *name, T &data)
         : ArgumentBase(name, static_cast<const void*>(&data))
     {
-        m_type = arguments::ArgumentType::value<T>();
+        m_type = arguments::ArgumentType::value<T&>();
     }
 
-    T value() const
+    T &value() const
     {
-        static_cast<T>(data);
+        return *static_cast<T*>(const_cast<void*>(m_data));
     }
 };
 
@@ -159,15 +303,14 @@ class ReturnArgument : public ReturnArgumentBase
 {
 public:
     inline ReturnArgument(const char *name, T &data)
-        : ReturnArgumentBase(name, static_cast<const void*>(data))
+        : ReturnArgumentBase(name, static_cast<const void*>(&data))
     {
+        m_type = arguments::ArgumentType::value<T>();
     }
 };
 
 #define ARG(type, value)        Argument<type>(#type, value)
 #define RET_ARG(type, value)    ReturnArgument<type>(#type, value)
 
-#define MAX_ARGS    3
-
 
 #endif // ARGUMENTS_H
@@ -0,0 +1,1016 @@
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <future>
+#include <algorithm>
+#include <initializer_list>
+#include <fstream>
+#include <random>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#if defined(__linux__)
+#include <elf.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+#include "metaclass.h"
+#include "metacallsite.h"
+#include "metawire.h"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// counts the heap allocations made by the benchmarked calls
+///
+static atomic<size_t> allocationCount = 0;
+void *operator new(size_t size)
+{
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    if (void *p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+// gcc inlines the deletes and flags the free() of what its builtin operator new returned
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+void operator delete[](void *p) noexcept
+{
+    operator delete(p);
+}
+void operator delete[](void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Hierarchy of Depth levels on top of MetaObject. The base level declares baseMethod
+/// and voidMethod, every level overrides levelMethod.
+///
+template<int Depth>
+class Level : public Level<Depth - 1>
+{
+    METACLASS_BEGIN(Level, Level<Depth - 1>)
+        META_METHOD(levelMethod, int, int)
+    METACLASS_END()
+public:
+    int levelMethod(int i) override { return i + Depth; }
+};
+template<int Depth>
+const MetaClass Level<Depth>::staticMetaObject { &Level<Depth - 1>::staticMetaObject, &Level<Depth>::initMetaClass, nullptr,
+                                                 &Level<Depth>::staticMetacall };
+
+template<>
+class Level<0> : public MetaObject
+{
+    METACLASS_BEGIN(Level, MetaObject)
+        META_METHOD(baseMethod, int, int)
+        META_METHOD(levelMethod, int, int)
+        META_METHOD(voidMethod, void)
+    METACLASS_END()
+public:
+    int baseMethod(int i) { return i; }
+    virtual int levelMethod(int i) { return i; }
+    void voidMethod() {}
+    int abstractMethod(const vector<int> &v) override { return int(v.size()); }
+};
+const MetaClass Level<0>::staticMetaObject { &MetaObject::staticMetaObject, &Level<0>::initMetaClass, nullptr,
+                                            &Level<0>::staticMetacall };
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Count overloads of the same name, each taking a distinct tag type.
+///
+template<int I>
+struct Tag
+{
+};
+
+template<int Count>
+class Overloads : public Level<0>
+{
+public:
+    static const MetaClass staticMetaObject;
+    const MetaClass *metaObject() const override { return &staticMetaObject; }
+
+    template<int I>
+    int overload(Tag<I>) { return I; }
+
+    static void initMetaClass(MetaClass *mo)
+    {
+        registerOverloads(mo, make_integer_sequence<int, Count>());
+    }
+
+private:
+    template<int... I>
+    static void registerOverloads(MetaClass *mo, integer_sequence<int, I...>)
+    {
+        (mo->addMetaMethod(new MetaMethod<Overloads, int, Tag<I>>(&Overloads::overload<I>, META_SYMBOL("overload"))), ...);
+    }
+};
+template<int Count>
+const MetaClass Overloads<Count>::staticMetaObject { &Level<0>::staticMetaObject, &Overloads<Count>::initMetaClass };
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// The results are printed as JSON lines, one object per measurement. Counters which
+/// are not available on the machine are reported as null.
+///
+template<typename T>
+inline void doNotOptimize(T &value)
+{
+    asm volatile("" : "+m"(value) : : "memory");
+}
+
+typedef initializer_list<pair<const char*, double>> Metrics;
+
+void report(const string &name, Metrics metrics)
+{
+    ostringstream line;
+    line << "{\"benchmark\": \"" << name << "\"";
+    for (const pair<const char*, double> &metric : metrics) {
+        line << ", \"" << metric.first << "\": ";
+        if (metric.second != metric.second) {
+            line << "null";
+        } else {
+            line << metric.second;
+        }
+    }
+    line << "}";
+    cout << line.str() << endl;
+}
+
+// user space instructions retired by the calling thread
+class InstructionCounter
+{
+    int m_fd = -1;
+
+public:
+    InstructionCounter()
+    {
+#if defined(__linux__)
+        perf_event_attr attr = {};
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        m_fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+    ~InstructionCounter()
+    {
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+    }
+
+    bool isAvailable() const
+    {
+        return m_fd >= 0;
+    }
+
+    void start()
+    {
+#if defined(__linux__)
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // NaN when not available
+    double stop()
+    {
+        uint64_t count = 0;
+#if defined(__linux__)
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(m_fd, &count, sizeof(count)) == sizeof(count)) {
+                return double(count);
+            }
+        }
+#endif
+        return NAN;
+    }
+};
+
+// calls is the number of calls f makes, the figures are reported per call
+template<typename Function>
+void benchmark(const string &name, size_t iterations, Function f, size_t calls = 1)
+{
+    static InstructionCounter instructions;
+    // warm up
+    for (size_t i = 0; i < iterations / 10; ++i) {
+        f();
+    }
+    const size_t allocations = allocationCount.load(memory_order_relaxed);
+    instructions.start();
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        f();
+    }
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+    const double instructionCount = instructions.stop();
+    const double callCount = double(iterations) * double(calls);
+    report(name, { { "ns_per_call", elapsed.count() / callCount },
+                   { "allocations_per_call", double(allocationCount.load(memory_order_relaxed) - allocations) / callCount },
+                   { "instructions_per_call", instructionCount / callCount } });
+}
+
+template<int Depth>
+void hierarchyDepth(size_t iterations)
+{
+    Level<Depth> object;
+    MetaObject *o = &object;
+    const string depth = "depth " + to_string(Depth + 1);
+
+    benchmark(depth + " lookup baseMethod", iterations, [o]() {
+        const MetaMethodRecord *method = o->metaObject()->getMethod<int>("baseMethod", arguments::signature<int>());
+        doNotOptimize(method);
+    });
+    benchmark(depth + " invoke baseMethod", iterations, [o]() {
+        int ret = 0;
+        MetaClass::invoke<int>(o, ret, "baseMethod", 1);
+        doNotOptimize(ret);
+    });
+    benchmark(depth + " invoke levelMethod", iterations, [o]() {
+        int ret = 0;
+        MetaClass::invoke<int>(o, ret, "levelMethod", 1);
+        doNotOptimize(ret);
+    });
+}
+
+// the same call through each of the dispatch paths
+void dispatchPaths(size_t iterations)
+{
+    Level<3> object;
+    Level<0> *o = &object;
+    benchmark("direct call", iterations, [&]() {
+        doNotOptimize(o);
+        int ret = o->baseMethod(1);
+        doNotOptimize(ret);
+    });
+    benchmark("virtual call", iterations, [&]() {
+        doNotOptimize(o);
+        int ret = o->levelMethod(1);
+        doNotOptimize(ret);
+    });
+    function<int(int)> function = [o](int i) { return o->levelMethod(i); };
+    benchmark("std::function", iterations, [&]() {
+        doNotOptimize(function);
+        int ret = function(1);
+        doNotOptimize(ret);
+    });
+    const tuple<int> args(1);
+    benchmark("tuple_invoke::apply", iterations, [&]() {
+        doNotOptimize(o);
+        int ret = tuple_invoke::apply(&Level<0>::levelMethod, o, args);
+        doNotOptimize(ret);
+    });
+    benchmark("MetaClass::invoke with return value", iterations, [&]() {
+        int ret = 0;
+        MetaClass::invoke<int>(o, ret, "levelMethod", 1);
+        doNotOptimize(ret);
+    });
+    const int levelMethod = o->metaObject()->indexOfMethod<int, int>("levelMethod");
+    benchmark("MetaClass::invokeByIndex", iterations, [&]() {
+        int i = 1;
+        int ret = 0;
+        void *args[] = { &ret, &i };
+        MetaClass::invokeByIndex(o, levelMethod, args);
+        doNotOptimize(ret);
+    });
+    benchmark("MetaClass::invoke converted argument", iterations, [&]() {
+        int ret = 0;
+        MetaClass::invoke<int>(o, ret, "levelMethod", short(1));
+        doNotOptimize(ret);
+    });
+    benchmark("MetaClass::invoke without return value", iterations, [&]() {
+        MetaClass::invoke<void>(o, "voidMethod");
+    });
+    benchmark("MetaClass::invoke dynamic no arguments", iterations, [&]() {
+        MetaClass::invoke(o, "voidMethod");
+    });
+    benchmark("MetaClass::invoke dynamic 1 argument", iterations, [&]() {
+        int i = 1;
+        int ret = 0;
+        MetaClass::invoke(o, "levelMethod", RET_ARG(int, ret), { ARG(int, i) });
+        doNotOptimize(ret);
+    });
+    MetaValue value;
+    benchmark("MetaClass::invoke MetaValue 1 argument", iterations, [&]() {
+        MetaValue args[] = { 1 };
+        MetaClass::invoke(o, "levelMethod", value, args);
+        doNotOptimize(value);
+    });
+}
+
+// the lookup scans the overloads registered under the name
+template<int Count>
+void overloadCount(size_t iterations)
+{
+    Overloads<Count> object;
+    MetaObject *o = &object;
+    const string overloads = to_string(Count) + " overloads";
+
+    benchmark(overloads + " lookup last overload", iterations, [o]() {
+        const MetaMethodRecord *method = o->metaObject()->getMethod<int>("overload", arguments::signature<Tag<Count - 1>>());
+        doNotOptimize(method);
+    });
+    benchmark(overloads + " invoke last overload", iterations, [o]() {
+        int ret = 0;
+        MetaClass::invoke<int>(o, ret, "overload", Tag<Count - 1>());
+        doNotOptimize(ret);
+    });
+    benchmark(overloads + " invoke unresolved", iterations, [o]() {
+        int ret = 0;
+        MetaClass::invoke<int>(o, ret, "overload", Tag<Count>());
+        doNotOptimize(ret);
+    });
+}
+
+void callSite(size_t iterations)
+{
+    Level<0> l0;
+    Level<3> l3;
+    Level<15> l15;
+    Level<0> *objects[] = { &l0, &l3, &l15 };
+    size_t index = 0;
+
+    benchmark("MetaCallSite monomorphic", iterations, [&]() {
+        static MetaCallSite<int, int> site("levelMethod");
+        int ret = 0;
+        site.invoke(objects[0], ret, 1);
+        doNotOptimize(ret);
+    });
+    benchmark("MetaClass::invoke 3 classes", iterations, [&]() {
+        int ret = 0;
+        MetaClass::invoke<int>(objects[index++ % 3], ret, "levelMethod", 1);
+        doNotOptimize(ret);
+    });
+    benchmark("MetaCallSite polymorphic 3 classes", iterations, [&]() {
+        static MetaCallSite<int, int> site("levelMethod");
+        int ret = 0;
+        site.invoke(objects[index++ % 3], ret, 1);
+        doNotOptimize(ret);
+    });
+}
+
+// the type queries made when matching the arguments of the dynamic invokes
+void typeQuery(size_t iterations)
+{
+    const type_index type = typeid(vector<int>);
+    benchmark("type id by type_index", iterations, [&type]() {
+        int id = MetaType::fromTypeIndex(type);
+        doNotOptimize(id);
+    });
+    int id = MetaType::IntVector;
+    benchmark("type info by id", iterations, [&id]() {
+        doNotOptimize(id);
+        size_t size = MetaType::info(id).size;
+        doNotOptimize(size);
+    });
+}
+
+// resident set size of the process in bytes
+size_t residentSize()
+{
+    size_t pages = 0, resident = 0;
+    if (FILE *statm = fopen("/proc/self/statm", "r")) {
+        if (fscanf(statm, "%zu %zu", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(statm);
+    }
+    return resident * size_t(sysconf(_SC_PAGESIZE));
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Classes of the startup benchmark, named Registered<I> and Tabled<I>. The Registered ones
+/// register their methods at runtime, the Tabled ones declare them in constexpr tables.
+///
+template<int I, bool Tabled>
+struct StartupName
+{
+    static constexpr array<char, 24> value = []() {
+        array<char, 24> name = {};
+        const char *prefix = Tabled ? "Tabled" : "Registered";
+        size_t length = 0;
+        while (prefix[length]) {
+            name[length] = prefix[length];
+            ++length;
+        }
+        size_t digits = 1;
+        for (int n = I; n >= 10; n /= 10) {
+            ++digits;
+        }
+        for (int n = I, d = int(length + digits) - 1; d >= int(length); n /= 10, --d) {
+            name[size_t(d)] = char('0' + n % 10);
+        }
+        return name;
+    }();
+};
+
+template<int I>
+class RegisteredStartup : public MetaObject
+{
+    METACLASS_BEGIN(RegisteredStartup, MetaObject)
+        META_METHOD(m0, int, int)
+        META_METHOD(m1, int, int)
+        META_METHOD(m2, int, double)
+        META_METHOD(m3, void)
+    METACLASS_END()
+public:
+    int m0(int i) { return i + I; }
+    int m1(int i) { return i - I; }
+    int m2(double d) { return int(d) * I; }
+    void m3() {}
+    int abstractMethod(const vector<int> &v) override { return int(v.size()); }
+};
+template<int I>
+const MetaClass RegisteredStartup<I>::staticMetaObject { &MetaObject::staticMetaObject, &RegisteredStartup<I>::initMetaClass,
+                                                         StartupName<I, false>::value.data() };
+
+template<int I>
+class TabledStartup : public MetaObject
+{
+    METATABLE_BEGIN(TabledStartup, MetaObject)
+        META_RECORD(m0, int, int)
+        META_RECORD(m1, int, int)
+        META_RECORD(m2, int, double)
+        META_RECORD(m3, void)
+    METATABLE_END()
+public:
+    int m0(int i) { return i + I; }
+    int m1(int i) { return i - I; }
+    int m2(double d) { return int(d) * I; }
+    void m3() {}
+};
+template<int I>
+const MetaClass TabledStartup<I>::staticMetaObject { &MetaObject::staticMetaObject, TabledStartup<I>::metaMethodTable(),
+                                                     StartupName<I, true>::value.data() };
+
+template<template<int> class Class, int... I>
+vector<const MetaClass*> startupClasses(integer_sequence<int, I...>)
+{
+    return { &Class<I>::staticMetaObject... };
+}
+
+// the first lookup of a method on each class, which initializes the class
+double firstLookups(const vector<const MetaClass*> &classes)
+{
+    auto start = chrono::steady_clock::now();
+    MetaEpoch::Guard guard;
+    ptrdiff_t found = 0;
+    for (const MetaClass *metaClass : classes) {
+        MetaClass::MetaMethodRange methods = metaClass->methods("m0");
+        found += methods.second - methods.first;
+    }
+    doNotOptimize(found);
+    return chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+}
+
+// runs the measurement in a child process, on classes not initialized before
+template<typename Function>
+void isolated(Function f)
+{
+    cout.flush();
+    const pid_t child = fork();
+    if (child == 0) {
+        f();
+        cout.flush();
+        _exit(0);
+    }
+    waitpid(child, nullptr, 0);
+}
+
+// the cost of the first use of the classes, registered at runtime, declared in constexpr
+// tables, and looked up in a mapped MetaImage
+constexpr int StartupCount = 500;
+
+void startup()
+{
+    constexpr int Count = StartupCount;
+    const vector<const MetaClass*> registered = startupClasses<RegisteredStartup>(make_integer_sequence<int, Count>());
+    const vector<const MetaClass*> tabled = startupClasses<TabledStartup>(make_integer_sequence<int, Count>());
+    const string path = "/tmp/metamethod-bench-" + to_string(getpid()) + ".image";
+    const string name = "startup " + to_string(Count) + " classes ";
+
+    isolated([&]() {
+        const size_t allocations = allocationCount.load(memory_order_relaxed);
+        const double elapsed = firstLookups(registered);
+        report(name + "runtime registration", { { "us", elapsed },
+                                                { "allocations", double(allocationCount.load(memory_order_relaxed) - allocations) } });
+    });
+    isolated([&]() {
+        const size_t allocations = allocationCount.load(memory_order_relaxed);
+        const double elapsed = firstLookups(tabled);
+        report(name + "constexpr tables", { { "us", elapsed },
+                                            { "allocations", double(allocationCount.load(memory_order_relaxed) - allocations) } });
+        MetaImage::write(path);
+    });
+    isolated([&]() {
+        const size_t allocations = allocationCount.load(memory_order_relaxed);
+        auto start = chrono::steady_clock::now();
+        unique_ptr<MetaImage> image = MetaImage::open(path);
+        if (!image) {
+            return;
+        }
+        MetaImage::install(image.get());
+        const double opened = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        const double elapsed = firstLookups(tabled);
+        report(name + "mapped image", { { "us", opened + elapsed },
+                                        { "us_open", opened },
+                                        { "allocations", double(allocationCount.load(memory_order_relaxed) - allocations) },
+                                        { "image_bytes", double(image->header().size) } });
+        MetaImage::install(nullptr);
+    });
+    remove(path.c_str());
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// The invoker thunks, per method or shared by the methods of a signature with
+/// METAMETHOD_SHARED_THUNKS: their code size, and the dispatch over the methods of the
+/// startup classes, warm and with a cold instruction cache.
+///
+// the total size of the functions of the executable whose symbol contains fragment, 0 if
+// the symbols are not available
+size_t functionBytes(const char *fragment)
+{
+#if defined(__linux__)
+    ifstream file("/proc/self/exe", ios::binary);
+    const string image((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+    if (image.size() < sizeof(Elf64_Ehdr) || memcmp(image.data(), ELFMAG, SELFMAG) != 0 || image[EI_CLASS] != ELFCLASS64) {
+        return 0;
+    }
+    const Elf64_Ehdr *header = reinterpret_cast<const Elf64_Ehdr*>(image.data());
+    const Elf64_Shdr *sections = reinterpret_cast<const Elf64_Shdr*>(image.data() + header->e_shoff);
+    size_t bytes = 0;
+    for (int i = 0; i < header->e_shnum; ++i) {
+        if (sections[i].sh_type != SHT_SYMTAB) {
+            continue;
+        }
+        const char *names = image.data() + sections[sections[i].sh_link].sh_offset;
+        const Elf64_Sym *symbols = reinterpret_cast<const Elf64_Sym*>(image.data() + sections[i].sh_offset);
+        for (size_t j = 0; j < sections[i].sh_size / sizeof(Elf64_Sym); ++j) {
+            if (ELF64_ST_TYPE(symbols[j].st_info) == STT_FUNC && strstr(names + symbols[j].st_name, fragment)) {
+                bytes += symbols[j].st_size;
+            }
+        }
+    }
+    return bytes;
+#else
+    (void)(fragment);
+    return 0;
+#endif
+}
+
+// runs a block of code larger than the instruction caches, evicting the code of the calls
+class CodeEvictor
+{
+    void *m_code = MAP_FAILED;
+    size_t m_size = 0;
+    void (*m_run)() = nullptr;
+
+public:
+    explicit CodeEvictor(size_t size)
+        : m_size(size)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        m_code = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m_code != MAP_FAILED) {
+            // nops followed by a ret
+            memset(m_code, 0x90, size - 1);
+            static_cast<unsigned char*>(m_code)[size - 1] = 0xc3;
+            if (mprotect(m_code, size, PROT_READ | PROT_EXEC) == 0) {
+                m_run = reinterpret_cast<void (*)()>(m_code);
+            }
+        }
+#endif
+    }
+    ~CodeEvictor()
+    {
+        if (m_code != MAP_FAILED) {
+            munmap(m_code, m_size);
+        }
+    }
+
+    bool isValid() const
+    {
+        return m_run != nullptr;
+    }
+
+    void operator()() const
+    {
+        m_run();
+    }
+};
+
+template<int... I>
+vector<unique_ptr<MetaObject>> startupObjects(integer_sequence<int, I...>)
+{
+    vector<unique_ptr<MetaObject>> objects;
+    (objects.emplace_back(new RegisteredStartup<I>), ...);
+    return objects;
+}
+
+void thunkSharing(size_t rounds)
+{
+#if defined(METAMETHOD_SHARED_THUNKS)
+    const string thunks = "shared invoker thunks ";
+#else
+    const string thunks = "invoker thunks ";
+#endif
+    report(thunks + to_string(StartupCount) + " classes",
+           { { "methods", double(StartupCount * 4) },
+             { "thunk_bytes", double(functionBytes("metainvoker4Call")) },
+             { "metamethod_bytes", double(functionBytes("10MetaMethodI")) } });
+
+    struct Dispatch
+    {
+        MetaObject *object;
+        const MetaMethodRecord *method;
+        void *argument;
+    };
+    const vector<unique_ptr<MetaObject>> objects = startupObjects(make_integer_sequence<int, StartupCount>());
+    int i = 1;
+    double d = 1.0;
+    vector<Dispatch> calls;
+    {
+        MetaEpoch::Guard guard;
+        for (const unique_ptr<MetaObject> &object : objects) {
+            calls.push_back({ object.get(), *object->metaObject()->methods("m0").first, &i });
+            calls.push_back({ object.get(), *object->metaObject()->methods("m1").first, &i });
+            calls.push_back({ object.get(), *object->metaObject()->methods("m2").first, &d });
+        }
+    }
+    shuffle(calls.begin(), calls.end(), mt19937(42));
+
+    // the calls in a random order, their code fits the instruction cache less without sharing
+    int ret = 0;
+    for (const Dispatch &call : calls) {
+        void *argv[] = { call.argument, nullptr };
+        call.method->callPacked(call.object, &ret, argv);
+    }
+    auto start = chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; ++round) {
+        for (const Dispatch &call : calls) {
+            void *argv[] = { call.argument, nullptr };
+            call.method->callPacked(call.object, &ret, argv);
+        }
+    }
+    chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+    doNotOptimize(ret);
+    report("shuffled dispatch " + to_string(calls.size()) + " methods", { { "ns_per_call", elapsed.count() / (rounds * calls.size()) } });
+
+    // every call after evicting the instruction cache
+    CodeEvictor evict(1 << 20);
+    if (!evict.isValid()) {
+        return;
+    }
+    elapsed = chrono::duration<double, nano>::zero();
+    for (const Dispatch &call : calls) {
+        void *argv[] = { call.argument, nullptr };
+        evict();
+        start = chrono::steady_clock::now();
+        call.method->callPacked(call.object, &ret, argv);
+        elapsed += chrono::steady_clock::now() - start;
+    }
+    doNotOptimize(ret);
+    report("cold cache dispatch", { { "ns_per_call", elapsed.count() / calls.size() } });
+}
+
+void objectCreation(size_t count)
+{
+    // the first reflective use registers the methods
+    {
+        Level<3> object;
+        int ret = 0;
+        MetaClass::invoke<int>(&object, ret, "levelMethod", 1);
+    }
+    for (size_t batch = 0; batch < 3; ++batch) {
+        const size_t rss = residentSize();
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            unique_ptr<MetaObject> object(new Level<3>);
+            int ret = 0;
+            MetaClass::invoke<int>(object.get(), ret, "levelMethod", 1);
+            doNotOptimize(ret);
+        }
+        chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+        report("create and invoke " + to_string(count) + " objects",
+               { { "ns_per_object", elapsed.count() / count },
+                 { "resident_bytes_grown", double((long long)(residentSize() - rss)) } });
+    }
+}
+
+// the same method on every object of a batch, per object and batched; reported per object
+void batchInvoke(size_t count, size_t iterations)
+{
+    Level<0> l0;
+    Level<3> l3;
+    Level<15> l15;
+    vector<int> v(3);
+    vector<int> results(count);
+    vector<MetaObject*> single(count, &l3);
+    vector<MetaObject*> mixed(count);
+    MetaObject *classes[] = { &l0, &l3, &l15 };
+    for (size_t i = 0; i < count; ++i) {
+        mixed[i] = classes[i % 3];
+    }
+
+    for (vector<MetaObject*> *batch : { &single, &mixed }) {
+        const string name = (batch == &single ? "single class " : "3 classes ") + to_string(count) + " objects";
+        span<MetaObject *const> objects(*batch);
+        benchmark(name + " invoke per object", iterations, [&]() {
+            for (size_t i = 0; i < count; ++i) {
+                MetaClass::invoke<int>(objects[i], results[i], "abstractMethod", v);
+            }
+            doNotOptimize(results);
+        }, count);
+        benchmark(name + " invokeBatch", iterations, [&]() {
+            MetaClass::invokeBatch<int>(objects, span<int>(results), "abstractMethod", v);
+            doNotOptimize(results);
+        }, count);
+        benchmark(name + " invokeBatchParallel", iterations, [&]() {
+            MetaClass::invokeBatchParallel<int>(objects, span<int>(results), "abstractMethod", v);
+            doNotOptimize(results);
+        }, count);
+    }
+}
+
+// requests fanning out 3 calls and waiting for all of them
+template<typename Function>
+void fanOut(const string &name, size_t requests, Function request)
+{
+    vector<double> latencies(requests);
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < requests; ++i) {
+        auto requestStart = chrono::steady_clock::now();
+        request();
+        latencies[i] = chrono::duration<double, micro>(chrono::steady_clock::now() - requestStart).count();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    sort(latencies.begin(), latencies.end());
+    report(name, { { "requests_per_s", requests / elapsed.count() },
+                   { "latency_p50_us", latencies[requests / 2] },
+                   { "latency_p99_us", latencies[requests * 99 / 100] },
+                   { "latency_p999_us", latencies[requests * 999 / 1000] } });
+}
+
+void asyncInvoke(size_t requests)
+{
+    Level<0> l0;
+    Level<3> l3;
+    Level<15> l15;
+    const vector<int> v(3);
+
+    fanOut("invokeAsync fan out 3 calls", requests, [&]() {
+        MetaFuture<int> f0 = MetaClass::invokeAsync<int>(&l0, "abstractMethod", v);
+        MetaFuture<int> f3 = MetaClass::invokeAsync<int>(&l3, "abstractMethod", v);
+        MetaFuture<int> f15 = MetaClass::invokeAsync<int>(&l15, "abstractMethod", v);
+        int ret = f0.get() + f3.get() + f15.get();
+        doNotOptimize(ret);
+    });
+    fanOut("std::async fan out 3 calls", requests, [&]() {
+        auto call = [&v](MetaObject *o) {
+            int ret = 0;
+            MetaClass::invoke<int>(o, ret, "abstractMethod", v);
+            return ret;
+        };
+        future<int> f0 = async(launch::async, call, &l0);
+        future<int> f3 = async(launch::async, call, &l3);
+        future<int> f15 = async(launch::async, call, &l15);
+        int ret = f0.get() + f3.get() + f15.get();
+        doNotOptimize(ret);
+    });
+}
+
+// remote invokes over the transport pair, served on a thread of its own
+template<typename Transports>
+void wireInvoke(const string &name, Transports transports, size_t requests)
+{
+    Level<0> l0;
+    MetaWireServer server;
+    const uint32_t id = server.add(&l0);
+    thread serving([&]() {
+        while (server.serve(*transports.second)) {
+        }
+    });
+    {
+        MetaWireClient client(*transports.first);
+        const vector<int> v(16);
+        int ret = 0;
+        fanOut(name + " round trip", requests, [&]() {
+            client.call<int, int>(id, "baseMethod", ret, 1);
+            doNotOptimize(ret);
+        });
+        fanOut(name + " round trip vector argument", requests, [&]() {
+            client.call<int, const vector<int>&>(id, "abstractMethod", ret, v);
+            doNotOptimize(ret);
+        });
+
+        // a window of calls on the way
+        constexpr size_t Window = 64;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < requests; i += Window) {
+            for (size_t w = 0; w < Window; ++w) {
+                client.post<int, int>(id, "baseMethod", 1);
+            }
+            for (size_t w = 0; w < Window; ++w) {
+                client.result(&ret);
+            }
+        }
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        const size_t sent = (requests + Window - 1) / Window * Window;
+        report(name + " pipelined " + to_string(Window), { { "messages_per_s", sent / elapsed.count() } });
+    }
+    transports.first.reset();
+    serving.join();
+}
+
+// keeps the calls until drained, so all of them are in flight at once
+class QueueScheduler : public MetaScheduler
+{
+public:
+    vector<MetaThreadPool::Task> tasks;
+
+    bool schedule(const MetaMethodRecord &, MetaThreadPool::Task task) override
+    {
+        tasks.push_back(task);
+        return true;
+    }
+    void drain()
+    {
+        for (MetaThreadPool::Task &task : tasks) {
+            task.run(task.context);
+        }
+        tasks.clear();
+    }
+};
+
+MetaTask awaitCall(MetaScheduler &scheduler, MetaObject *o, atomic<size_t> &done)
+{
+    int ret = co_await MetaClass::call<int>(scheduler, o, "levelMethod", 1);
+    doNotOptimize(ret);
+    done.fetch_add(1, memory_order_release);
+}
+
+void coroutineInvoke(size_t count)
+{
+    Level<3> object;
+    QueueScheduler queue;
+    queue.tasks.reserve(count);
+    atomic<size_t> done = 0;
+    // the second round runs on recycled frames
+    for (int round = 1; round <= 2; ++round) {
+        const size_t rss = residentSize();
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            awaitCall(queue, &object, done);
+        }
+        chrono::duration<double, nano> suspend = chrono::steady_clock::now() - start;
+        const long long grown = (long long)(residentSize() - rss);
+        start = chrono::steady_clock::now();
+        queue.drain();
+        chrono::duration<double, nano> resume = chrono::steady_clock::now() - start;
+        report("coroutine round " + to_string(round) + " " + to_string(count) + " calls in flight",
+               { { "resident_bytes_per_call", grown / double(count) },
+                 { "suspend_ns_per_call", suspend.count() / count },
+                 { "resume_ns_per_call", resume.count() / count } });
+    }
+
+    MetaPoolScheduler pool;
+    MetaPoolScheduler inlined;
+    inlined.setInline("levelMethod");
+    for (MetaPoolScheduler *scheduler : { &pool, &inlined }) {
+        done.store(0);
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) {
+            awaitCall(*scheduler, &object, done);
+        }
+        while (done.load(memory_order_acquire) < count) {
+            this_thread::yield();
+        }
+        chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+        report(string("coroutine ") + (scheduler == &pool ? "on thread pool" : "inline"),
+               { { "ns_per_call", elapsed.count() / count } });
+    }
+}
+
+#if defined(METAMETHOD_STATS)
+// the cost of counting the calls, measured on the cheapest dispatch path
+void statsOverhead(size_t iterations)
+{
+    Level<3> object;
+    MetaObject *o = &object;
+    MetaCallSite<int, int> site("levelMethod");
+    auto call = [&]() {
+        int ret = 0;
+        site.invoke(o, ret, 1);
+        doNotOptimize(ret);
+    };
+    MetaStats::setEnabled(false);
+    benchmark("call site stats disabled", iterations, call);
+    MetaStats::setEnabled(true);
+    benchmark("call site stats enabled", iterations, call);
+    MetaStats::setEnabled(false);
+}
+#endif
+
+// invocations on all the threads, while a writer registers a method each millisecond
+void concurrentInvoke(chrono::milliseconds duration)
+{
+    const unsigned cores = max(thread::hardware_concurrency(), 1u);
+    MetaClass *mo = const_cast<MetaClass*>(&Level<3>::staticMetaObject);
+    size_t registered = 0;
+    for (unsigned threads = 1; threads <= 2 * cores; threads *= 2) {
+        atomic<bool> done = false;
+        atomic<size_t> calls = 0;
+        vector<thread> readers;
+        for (unsigned t = 0; t < threads; ++t) {
+            readers.emplace_back([&]() {
+                Level<3> object;
+                size_t count = 0;
+                while (!done.load(memory_order_relaxed)) {
+                    int ret = 0;
+                    MetaClass::invoke<int>(&object, ret, "levelMethod", 1);
+                    doNotOptimize(ret);
+                    ++count;
+                }
+                calls += count;
+            });
+        }
+        auto start = chrono::steady_clock::now();
+        size_t registrations = 0;
+        while (chrono::steady_clock::now() - start < duration) {
+            mo->addMetaMethod(new MetaMethod<Level<0>, int, int>(&Level<0>::baseMethod,
+                                                                 MetaSymbol("plugin" + to_string(registered++))));
+            ++registrations;
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        done.store(true, memory_order_relaxed);
+        for (thread &reader : readers) {
+            reader.join();
+        }
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        report("concurrent invoke " + to_string(threads) + " threads",
+               { { "calls_per_s", calls.load() / elapsed.count() },
+                 { "registrations", double(registrations) } });
+    }
+}
+
+int main()
+{
+    const size_t iterations = 1000000;
+    // forks, before any thread is started
+    startup();
+    thunkSharing(100);
+    dispatchPaths(iterations);
+    overloadCount<1>(iterations);
+    overloadCount<4>(iterations);
+    overloadCount<16>(iterations);
+    overloadCount<32>(iterations);
+    overloadCount<64>(iterations);
+    hierarchyDepth<0>(iterations);
+    hierarchyDepth<3>(iterations);
+    hierarchyDepth<15>(iterations);
+    callSite(iterations);
+    typeQuery(iterations);
+    objectCreation(iterations);
+    batchInvoke(100000, 100);
+    asyncInvoke(20000);
+    coroutineInvoke(100000);
+    wireInvoke("wire socketpair", MetaSocketTransport::createPair(), 100000);
+    wireInvoke("wire shared memory ring", MetaRingTransport::createPair(), 100000);
+    concurrentInvoke(chrono::milliseconds(200));
+#if defined(METAMETHOD_STATS)
+    statsOverhead(iterations);
+#endif
+    return 0;
+}
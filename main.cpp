@@ -1,8 +1,204 @@
 #include <iostream>
+#include <cstdlib>
+#include <thread>
+#include <numeric>
+#include <cstdio>
+#include <array>
+#include <stdexcept>
 #include "metaclass.h"
+#include "metacallsite.h"
+#include "metawire.h"
 
 using namespace std;
 
+//////////////////////////////////////////////////////////////////////////////////////
+/// counts the heap allocations to verify the allocation free invoke paths
+///
+static atomic<size_t> allocationCount = 0;
+void *operator new(size_t size)
+{
+    ++allocationCount;
+    if (void *p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw bad_alloc();
+}
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+// gcc inlines the deletes and flags the free() of what its builtin operator new returned
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+void operator delete(void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+void operator delete[](void *p) noexcept
+{
+    operator delete(p);
+}
+void operator delete[](void *p, size_t) noexcept
+{
+    operator delete(p);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// user types of the type registry
+///
+struct Point
+{
+    int x = 0;
+    int y = 0;
+    bool operator ==(const Point &) const = default;
+};
+// any bytes are a valid Point, it is sent over the wire as it is
+template<> struct MetaRawValue<Point> : true_type {};
+
+struct Handle
+{
+    unique_ptr<int> value;
+};
+
+// its construction throws, inline or not
+template<size_t Size>
+struct Throwing
+{
+    explicit Throwing(int) { throw runtime_error("not constructed"); }
+    char data[Size];
+};
+
+#if defined(__clang__)
+    #define NOT_CLONED [[gnu::noinline]]
+#else
+    #define NOT_CLONED [[gnu::noipa]]
+#endif
+
+// no default constructor, returned by the invokes constructing in place
+struct Token
+{
+    explicit Token(int id) : id(id) {}
+    int id;
+    bool operator ==(const Token &) const = default;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// takes its arguments by value, by reference and by move
+///
+class Sink : public MetaObject
+{
+    METACLASS_BEGIN(Sink, MetaObject)
+        META_METHOD(keepVector, size_t, vector<int>)
+        META_METHOD(keepString, size_t, string)
+        META_METHOD(viewVector, size_t, const vector<int>&)
+        META_METHOD(swapIn, size_t, vector<int>&&)
+        META_METHOD(take, int, unique_ptr<int>)
+        META_METHOD(make, unique_ptr<int>, int)
+        META_METHOD(fill, vector<int>, int)
+        META_METHOD(token, Token, int)
+        META_METHOD(scaled, int, int)
+        META_METHOD(abstractMethod, int, const vector<int>&)
+    METACLASS_END()
+public:
+    vector<int> m_vector;
+    string m_string;
+
+    size_t keepVector(vector<int> v) { m_vector = move(v); return m_vector.size(); }
+    size_t keepString(string s) { m_string = move(s); return m_string.size(); }
+    size_t viewVector(const vector<int> &v) { return v.size(); }
+    size_t swapIn(vector<int> &&v) { m_vector.swap(v); return m_vector.size(); }
+    int take(unique_ptr<int> p) { return p ? *p : -1; }
+    unique_ptr<int> make(int i) { return make_unique<int>(i); }
+    vector<int> fill(int n) { return vector<int>(n, n); }
+    Token token(int id) { return Token(id); }
+    // out of line and not cloned, so the direct calls of it show in the machine code
+    NOT_CLONED int scaled(int i) { return 3 * i; }
+    int abstractMethod(const vector<int> &v) override { return int(v.size()); }
+};
+METAOBJECT(Sink, MetaObject)
+
+// resolved at compile time into a direct call of Sink::scaled()
+[[gnu::noinline]] int staticScaled(Sink *sink, int i)
+{
+    return MetaClass::invokeStatic<int, "scaled">(sink, i);
+}
+
+#if defined(__x86_64__) && defined(__OPTIMIZE__)
+// true if the first bytes of the machine code of the function hold a call or a jump to target;
+// the unoptimized builds call through the member pointer
+static bool callsDirectly(const void *function, const void *target)
+{
+    const unsigned char *code = static_cast<const unsigned char*>(function);
+    for (size_t i = 0; i < 64; ++i) {
+        if (code[i] == 0xe8 || code[i] == 0xe9) {
+            int32_t offset = 0;
+            memcpy(&offset, code + i + 1, sizeof(offset));
+            if (code + i + 5 + offset == target) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+#endif
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// overloads reached through argument conversions
+///
+class Converting : public MetaObject
+{
+    METACLASS_BEGIN(Converting, MetaObject)
+        META_METHOD(overload, int, double)
+        META_METHOD(overload, int, long)
+        META_METHOD(sum, int, span<const int>)
+        META_METHOD(pointWidth, int, const Point&)
+    METACLASS_END()
+public:
+    int overload(double) { return 2; }
+    int overload(long) { return 1; }
+    int sum(span<const int> values) { return accumulate(values.begin(), values.end(), 0); }
+    int pointWidth(const Point &p) { return p.x; }
+    int abstractMethod(const vector<int> &) override { return 0; }
+};
+METAOBJECT(Converting, MetaObject)
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// methods invoked over the wire transports
+///
+class Remote : public MetaObject
+{
+    METACLASS_BEGIN(Remote, MetaObject)
+        META_METHOD(scale, int, int, double)
+        META_METHOD(textLength, size_t, string_view)
+        META_METHOD(sum, int, span<const int>)
+        META_METHOD(greet, string, const string&)
+        META_METHOD(range, vector<int>, int)
+        META_METHOD(mirror, Point, Point)
+        META_METHOD(store, void, int)
+    METACLASS_END()
+public:
+    int scale(int i, double factor) { return int(i * factor); }
+    size_t textLength(string_view text) { return text.size(); }
+    int sum(span<const int> values) { return accumulate(values.begin(), values.end(), 0); }
+    string greet(const string &name) { return "hello " + name; }
+    vector<int> range(int count) { vector<int> v(count); iota(v.begin(), v.end(), 0); return v; }
+    Point mirror(Point p) { return Point { p.y, p.x }; }
+    void store(int value) { stored = value; }
+    int abstractMethod(const vector<int> &) override { return 0; }
+
+    int stored = 0;
+};
+METAOBJECT(Remote, MetaObject)
+
 //////////////////////////////////////////////////////////////////////////////////////
 ///
 ///
@@ -17,6 +213,8 @@ class Object : public MetaObject
         META_METHOD(intRetVectorFunc, size_t, int, const vector<int>&)
         META_METHOD(intRetVectorFunc2, int, int, const vector<int>&)
         META_METHOD(voidStringFunc, void, const string&)
+        META_METHOD(outArgFunc, void, int&)
+        META_METHOD(tenArgsFunc, int, int, int, int, int, int, int, int, int, int, int)
         META_METHOD(voidCStringFunc, void, const char*)
         META_METHOD(abstractMethod, int, const vector<int>&)
     METACLASS_END()
@@ -24,9 +222,7 @@ public:
     template<class TObject>
     static TObject *create()
     {
-        TObject *object = new TObject;
-        object->initMetaClass(object);
-        return object;
+        return new TObject;
     }
     virtual ~Object() {}
 
@@ -38,6 +234,11 @@ public:
     size_t intRetVectorFunc(int, const vector<int> &v) { return v.size(); }
     int intRetVectorFunc2(int i, const vector<int> &v) { return i * int(v.size()); }
     void voidStringFunc(const string &s) { cout << "STRING: " << s << endl; }
+    void outArgFunc(int &out) { out = 42; }
+    int tenArgsFunc(int a, int b, int c, int d, int e, int f, int g, int h, int i, int j)
+    {
+        return a + b + c + d + e + f + g + h + i + j;
+    }
     void voidCStringFunc(const char *s) { cout << "CSTRING: " << s << endl; }
     int abstractMethod(const vector<int>& v) override { return 100 * v.size(); }
 
@@ -60,10 +261,70 @@ public:
 };
 METAOBJECT(Derived, Object)
 
+//////////////////////////////////////////////////////////////////////////////////////
+/// a constexpr table extended at runtime
+///
+class Extended : public Object
+{
+    METATABLE_BEGIN(Extended, Object)
+        META_RECORD(derivedFunc, int, int)
+    METATABLE_END()
+public:
+    int derivedFunc(int i) { return -i; }
+    int derivedFunc(int a, int b) { return a - b; }
+};
+METATABLE_OBJECT(Extended, Object)
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// constexpr tables looked up in a MetaImage
+///
+class Tabled : public Object
+{
+    METATABLE_BEGIN(Tabled, Object)
+        META_RECORD(intRetVectorFunc, size_t, const vector<int>&)
+        META_RECORD(tripled, int, int)
+    METATABLE_END()
+public:
+    size_t intRetVectorFunc(const vector<int> &v) override { return 3 * v.size(); }
+    int tripled(int i) { return 3 * i; }
+};
+METATABLE_OBJECT(Tabled, Object)
+
+class TabledLeaf : public Tabled
+{
+    METATABLE_BEGIN(TabledLeaf, Tabled)
+        META_RECORD(leafFunc, int, int)
+    METATABLE_END()
+public:
+    int leafFunc(int i) { return -i; }
+};
+METATABLE_OBJECT(TabledLeaf, Tabled)
+
 
 //////////////////////////////////////////////////////////////////////////////////////
 ///
 ///
+// awaits the calls of the object's methods, resumed on the thread which made the last call
+MetaTask awaitCalls(MetaObject *object, MetaScheduler &scheduler, vector<int> &results, atomic<bool> &done)
+{
+    results.push_back(co_await MetaClass::call<int>(scheduler, object, "intRetArgFunc", 4));
+    results.push_back(co_await MetaClass::call<int>(scheduler, object, "intRetFunc"));
+    auto missing = MetaClass::call<int>(scheduler, object, "derivedFunc", 1);
+    results.push_back(missing.isValid() ? -1 : co_await missing);
+    results.push_back(int(co_await MetaClass::call<size_t>(object, "intRetVectorFunc", vector<int>(3))));
+    done.store(true, memory_order_release);
+}
+
+// awaits results which cannot be default constructed
+MetaTask awaitTokens(MetaObject *object, vector<int> &results, atomic<bool> &done)
+{
+    optional<Token> token = co_await MetaClass::call<Token>(object, "token", 7);
+    results.push_back(token ? token->id : -1);
+    optional<Token> missing = co_await MetaClass::call<Token>(object, "noSuchMethod", 1);
+    results.push_back(missing ? missing->id : -1);
+    done.store(true, memory_order_release);
+}
+
 #define VERIFY(a)   if (!(a)) cerr << #a << " FAILED" << endl
 #define COMPARE(a, e)   if ((a) != (e)) cerr << "FAILED" << endl << "Actual: " << a  << endl << "Expected: " << e << endl
 int main()
@@ -100,7 +361,8 @@ int main()
     VERIFY(MetaClass::invoke<void>(object.get(), "voidStringFunc", string("foo")));
     bool b = MetaClass::invoke<void, const string&>(object.get(), "voidStringFunc", "foo");
     VERIFY(b);
-    VERIFY(!MetaClass::invoke<void>(object.get(), "voidStringFunc", "foo"));
+    // the const char* is converted to string, see MetaConversion
+    VERIFY(MetaClass::invoke<void>(object.get(), "voidStringFunc", "foo"));
     VERIFY(MetaClass::invoke<void>(object.get(), "voidCStringFunc", "foo"));
 
     unique_ptr<Derived> o2(Derived::create<Derived>());
@@ -116,6 +378,7 @@ int main()
 
     // invoke via polymorphism
     MetaObject *metaObject = o2.get();
+    unique_ptr<Extended> extended(Extended::create<Extended>());
     ret = -1;
     VERIFY(MetaClass::invoke<int>(metaObject, ret, "abstractMethod", v));
     COMPARE(ret, 2000);
@@ -123,22 +386,70 @@ int main()
     VERIFY(MetaClass::invoke<void>(o2.get(), "voidFunc"));
     VERIFY(MetaClass::invoke<void>(metaObject, "voidFunc"));
 
-    MetaClass::MetaMethodRange range = MetaClass::methodRange(object.get(), "intRetVectorFunc");
-    for (MetaClass::MetaMethodIterator i = range.first; i != range.second; ++i) {
-        cout << "method " << i->second->argumentCount() << endl;
-        for (arguments::ArgIterator j = i->second->argumentsBegin(); j != i->second->argumentsEnd(); ++j) {
-            cout << "  arg " << j->m_type.name() << endl;
+    // overrides shadow the inherited methods, other overloads stay callable
+    uret = 0;
+    VERIFY(MetaClass::invoke<size_t>(metaObject, uret, "intRetVectorFunc", v));
+    COMPARE(uret, 20);
+    uret = 0;
+    VERIFY(MetaClass::invoke<size_t>(metaObject, uret, "intRetVectorFunc", 1, v));
+    COMPARE(uret, 10);
+
+    // names given as string_view and string resolve to the same symbol
+    VERIFY(MetaClass::invoke<void>(metaObject, string_view("voidFunc")));
+    VERIFY(MetaClass::invoke<void>(metaObject, string("voidFunc")));
+    VERIFY(!MetaClass::invoke<void>(metaObject, string_view("voidFunc2")));
+
+    // methods declared in a constexpr table, and added at runtime
+    ret = 0;
+    VERIFY(MetaClass::invoke<int>(extended.get(), ret, "derivedFunc", 5));
+    COMPARE(ret, -5);
+    VERIFY(!MetaClass::invoke<int>(object.get(), ret, "derivedFunc", 5));
+    {
+        typedef class Extended TClass;
+        MetaClass *mo = const_cast<MetaClass*>(&Extended::staticMetaObject);
+        META_ADD_METHOD(derivedFunc, int, int, int)
+    }
+    {
+        MetaEpoch::Guard guard;
+        MetaClass::MetaMethodRange derivedFuncs = Extended::staticMetaObject.declaredMethods("derivedFunc");
+        COMPARE(derivedFuncs.second - derivedFuncs.first, 2);
+    }
+    ret = 0;
+    VERIFY(MetaClass::invoke<int>(extended.get(), ret, "derivedFunc", 6));
+    COMPARE(ret, -6);
+    VERIFY(MetaClass::invoke<int>(extended.get(), ret, "derivedFunc", 6, 4));
+    COMPARE(ret, 2);
+
+    // call sites
+    for (int i = 0; i < 3; ++i) {
+        static MetaCallSite<int, const vector<int>&> abstractMethod("abstractMethod");
+        ret = -1;
+        VERIFY(abstractMethod.invoke(object.get(), ret, v));
+        COMPARE(ret, 1000);
+        ret = -1;
+        VERIFY(abstractMethod.invoke(metaObject, ret, v));
+        COMPARE(ret, 2000);
+
+        static MetaCallSite<void, int> voidFunc("voidFunc");
+        VERIFY(!voidFunc.invoke(object.get(), 10));
+    }
+
+    {
+        MetaEpoch::Guard guard;
+        MetaClass::MetaMethodRange range = MetaClass::methodRange(object.get(), "intRetVectorFunc");
+        for (MetaClass::MetaMethodIterator i = range.first; i != range.second; ++i) {
+            cout << "method " << (*i)->argumentCount() << endl;
+            for (arguments::ArgIterator j = (*i)->argumentsBegin(); j != (*i)->argumentsEnd(); ++j) {
+                cout << "  arg " << j->type().name() << endl;
+            }
         }
     }
 
     // tuple_invoke
     {
-        arguments::ArgContainer args = {
-            arguments::ArgumentType::value<int>(),
-            arguments::ArgumentType::value<vector<int>>()
-        };
+        arguments::ArgContainer args = arguments::signature<int, vector<int>>();
         const MetaClass *mo = object->metaObject();
-        const MetaMethodBase *method = mo->getMethod<int>("intRetVectorFunc", args);
+        const MetaMethodRecord *method = mo->getMethod<int>("intRetVectorFunc", args);
         (void)(method);
         auto t = make_tuple(12, vector<int>({1, 2, 3, 4}));
         Object *o = object.get();
@@ -146,7 +457,851 @@ int main()
 //        method->apply<Object>(object.get(), &Object::intRetVectorFunc, t);
     }
 
+    // argument types are packed into dense type ids and qualifier flags
+    VERIFY(arguments::ArgumentType::value<int>().typeId() == MetaType::Int);
+    VERIFY(arguments::ArgumentType::value<const vector<int>&>().typeId() == MetaType::IntVector);
+    VERIFY(arguments::ArgumentType::value<const vector<int>&>().isConst());
+    VERIFY(arguments::ArgumentType::value<const char*>().isPointer());
+    VERIFY(arguments::ArgumentType::value<const char*>().typeId() >= MetaType::UserType);
+    VERIFY(arguments::ArgumentType::value<const char*>().type() == type_index(typeid(const char*)));
+    VERIFY(MetaType::fromTypeIndex(typeid(const char*)) == arguments::ArgumentType::value<const char*>().typeId());
+
+    // the ids of the built-in types are constants, the infos are looked up by id
+    {
+        static_assert(MetaType::id<int> == MetaType::Int);
+        static_assert(MetaType::id<const string&> == MetaType::String);
+        VERIFY(MetaType::id<Point> >= MetaType::UserType);
+        COMPARE(MetaType::registerType<Point>(), MetaType::id<Point>);
+        COMPARE(MetaType::typeId<const Point&>(), MetaType::id<Point>);
+        COMPARE(MetaType::fromTypeIndex(typeid(Point)), MetaType::id<Point>);
+        VERIFY(MetaType::typeIndex(MetaType::id<Point>) == type_index(typeid(Point)));
+        VERIFY(MetaType(MetaType::id<Point>).isValid());
+        VERIFY(!MetaType(MetaType::Undefined).isValid());
+
+        const MetaType::Info &info = MetaType::info(MetaType::id<Point>);
+        COMPARE(info.size, sizeof(Point));
+        COMPARE(info.alignment, alignof(Point));
+        const Point p { 3, 4 };
+        alignas(Point) char buffer[sizeof(Point)];
+        info.copy(buffer, &p);
+        VERIFY(info.equals(buffer, &p));
+        info.destroy(buffer);
+
+        const MetaType::Info &handle = MetaType::info(MetaType::typeId<Handle>());
+        VERIFY(!handle.copy && handle.move && handle.destroy && !handle.equals);
+        COMPARE(MetaType::info(MetaType::Int).size, sizeof(int));
+        VERIFY(MetaType::info(MetaType::IntVector).equals);
+        VERIFY(*MetaType::info(-5).type == typeid(void));
+    }
+
+    // signature hashes cover the return type and the qualifiers of the arguments
+    VERIFY((arguments::signatureHash<int, const vector<int>&>() != arguments::signatureHash<int, vector<int>>()));
+    VERIFY((arguments::signatureHash<int, int>() != arguments::signatureHash<size_t, int>()));
+    VERIFY((arguments::signatureHash<void, int, int>() != arguments::signatureHash<void, int>()));
+    // a signature hash colliding with the one of another overload does not resolve to it
+    VERIFY(object->metaObject()->getMethod<int>("intRetArgFunc", arguments::signature<int>(),
+                                                arguments::signatureHash<int, int>()) != nullptr);
+    VERIFY(object->metaObject()->getMethod<int>("intRetArgFunc", arguments::signature<string>(),
+                                                arguments::signatureHash<int, int>()) == nullptr);
+
+    // the templated invoke does not allocate, once the resolutions are memoized
+    for (int round = 0; round < 2; ++round) {
+        const size_t allocations = allocationCount;
+        VERIFY(MetaClass::invoke<int>(object.get(), ret, "intRetArgFunc", 5));
+        VERIFY(MetaClass::invoke<int>(object.get(), ret, "intRetFunc"));
+        b = MetaClass::invoke<int, const vector<int>&>(metaObject, ret, "abstractMethod", v);
+        VERIFY(b);
+        VERIFY(!MetaClass::invoke<void>(object.get(), "voidFunc", 10));
+        if (round) {
+            COMPARE(allocationCount - allocations, 0u);
+        }
+    }
+    // more invokes than the memoized resolutions hold replace each other in the cache, still
+    // without allocating
+    {
+        vector<string> missing;
+        for (int i = 0; i < 64; ++i) {
+            missing.push_back("missing" + to_string(i));
+        }
+        for (int round = 0; round < 2; ++round) {
+            const size_t allocations = allocationCount;
+            for (const string &name : missing) {
+                VERIFY(!MetaClass::invoke<int>(object.get(), ret, MetaSymbol(name), 5));
+                VERIFY(MetaClass::invoke<int>(object.get(), ret, "intRetArgFunc", 5));
+            }
+            if (round) {
+                COMPARE(allocationCount - allocations, 0u);
+            }
+        }
+    }
+
+    // the arguments are forwarded: the lvalues bind to the references, the rvalues are moved
+    // into the by-value parameters, the results are moved or constructed in place
+    {
+        Sink sink;
+        size_t size = 0;
+        vector<int> big(100000, 1);
+        string text(10000, 'x');
+        vector<int> swapped(1000, 2);
+        // each measured invoke follows an allocation free one resolving the method; the first
+        // invoke initializes the class
+        VERIFY(MetaClass::invoke<size_t>(&sink, size, "viewVector", swapped));
+        VERIFY(MetaClass::invoke<size_t>(&sink, size, "viewVector", swapped));
+        size_t allocations = allocationCount;
+        VERIFY(MetaClass::invoke<size_t>(&sink, size, "viewVector", big));
+        COMPARE(allocationCount - allocations, 0u);
+        COMPARE(size, big.size());
+
+        VERIFY(MetaClass::invoke<size_t>(&sink, size, "keepVector", vector<int>()));
+        allocations = allocationCount;
+        VERIFY(MetaClass::invoke<size_t>(&sink, size, "keepVector", move(big)));
+        COMPARE(allocationCount - allocations, 0u);
+        VERIFY(big.empty() && sink.m_vector.size() == 100000u);
+
+        VERIFY(MetaClass::invoke<size_t>(&sink, size, "keepString", string()));
+        allocations = allocationCount;
+        VERIFY(MetaClass::invoke<size_t>(&sink, size, "keepString", move(text)));
+        COMPARE(allocationCount - allocations, 0u);
+        VERIFY(text.empty() && sink.m_string.size() == 10000u);
+
+        VERIFY(MetaClass::invoke<size_t>(&sink, size, "swapIn", vector<int>(100000)));
+        allocations = allocationCount;
+        VERIFY(MetaClass::invoke<size_t>(&sink, size, "swapIn", move(swapped)));
+        COMPARE(allocationCount - allocations, 0u);
+        COMPARE(swapped.size(), 100000u);
+
+        // the lvalues are copied once into the by-value parameters
+        VERIFY(MetaClass::invoke<size_t>(&sink, size, "keepVector", big));
+        allocations = allocationCount;
+        VERIFY(MetaClass::invoke<size_t>(&sink, size, "keepVector", swapped));
+        COMPARE(allocationCount - allocations, 1u);
+        COMPARE(swapped.size(), 100000u);
+
+        // the lvalues and the const values do not bind to rvalue and non-const references
+        vector<int> kept(3);
+        VERIFY(!MetaClass::invoke<size_t>(&sink, size, "swapIn", kept));
+        COMPARE(kept.size(), 3u);
+        const int constant = 1;
+        VERIFY(!MetaClass::invoke<void>(object.get(), "outArgFunc", constant));
+        int out = 0;
+        VERIFY(MetaClass::invoke<void>(object.get(), "outArgFunc", out));
+        COMPARE(out, 42);
+
+        // move-only arguments and results
+        int taken = 0;
+        VERIFY(MetaClass::invoke<int>(&sink, taken, "take", make_unique<int>(7)));
+        COMPARE(taken, 7);
+        // the lvalues and the const values would be copied, they do not resolve and are left as they are
+        unique_ptr<int> owned = make_unique<int>(8);
+        const unique_ptr<int> ownedConst = make_unique<int>(8);
+        VERIFY(!MetaClass::invoke<int>(&sink, taken, "take", owned));
+        VERIFY(!MetaClass::invoke<int>(&sink, taken, "take", ownedConst));
+        VERIFY(!MetaClass::invoke(&sink, "take", RET_ARG(int, taken), { ARG(unique_ptr<int>, owned) }));
+        VERIFY(!MetaClass::invoke(&sink, "take", RET_ARG(int, taken), { ARG(unique_ptr<int>&, owned) }));
+        VERIFY(owned && *owned == 8);
+        VERIFY(ownedConst && *ownedConst == 8);
+        COMPARE(taken, 7);
+        unique_ptr<int> made;
+        VERIFY(MetaClass::invoke<unique_ptr<int>>(&sink, made, "make", 9));
+        VERIFY(made && *made == 9);
+        vector<int> filled;
+        for (int round = 0; round < 2; ++round) {
+            const size_t allocations = allocationCount;
+            VERIFY(MetaClass::invoke<vector<int>>(&sink, filled, "fill", 50000));
+            if (round) {
+                COMPARE(allocationCount - allocations, 1u);
+            }
+        }
+        COMPARE(filled.size(), 50000u);
+
+        // the MetaValue results are constructed in place, with no default constructor
+        MetaValue result;
+        MetaValue id = 5;
+        VERIFY(MetaClass::invoke(&sink, "token", result, span<MetaValue>(&id, 1)));
+        VERIFY(result.value<Token>() && result.value<Token>()->id == 5);
+        id = 6;
+        VERIFY(MetaClass::invoke(&sink, "token", result, span<MetaValue>(&id, 1)));
+        COMPARE(result.value<Token>()->id, 6);
+    }
+
+    // the static types resolve at compile time, with no lookup
+    {
+        COMPARE((MetaClass::invokeStatic<int, "intRetArgFunc">(object.get(), 5)), 50);
+        COMPARE((MetaClass::invokeStatic<size_t, "intRetVectorFunc">(object.get(), 2, v)), v.size());
+        MetaClass::invokeStatic<void, "voidCStringFunc">(object.get(), "static");
+        int out = 0;
+        MetaClass::invokeStatic<void, "outArgFunc">(object.get(), out);
+        COMPARE(out, 42);
+        // inherited through a table class, and dispatched to the override
+        COMPARE((MetaClass::invokeStatic<int, "intRetArgFunc">(extended.get(), 2)), 20);
+        Derived *derived = static_cast<Derived*>(metaObject);
+        COMPARE((MetaClass::invokeStatic<int, "abstractMethod">(static_cast<MetaObject*>(derived), v)), 2000);
+
+        Sink sink;
+        vector<int> moved(100);
+        COMPARE((MetaClass::invokeStatic<size_t, "keepVector">(&sink, move(moved))), 100u);
+        VERIFY(moved.empty());
+        COMPARE((MetaClass::invokeStatic<int, "take">(&sink, make_unique<int>(3))), 3);
+        COMPARE((MetaClass::invokeStatic<Token, "token">(&sink, 4).id), 4);
+        COMPARE(staticScaled(&sink, 5), 15);
+
+        // the names and the argument types missing from the declarations do not compile
+        static_assert(metastatic::Method<Object, "intRetArgFunc", int, int>::found);
+        static_assert(!metastatic::Method<Object, "missing", int, int>::found);
+        static_assert(!metastatic::Method<Object, "intRetArgFunc", int, short>::found);
+        static_assert(!metastatic::Method<Object, "outArgFunc", void, const int&>::found);
+        static_assert(!metastatic::Method<Sink, "swapIn", size_t, vector<int>&>::found);
+        static_assert(!metastatic::Method<MetaObject, "intRetArgFunc", int, int>::found);
+#if defined(__x86_64__) && defined(__OPTIMIZE__)
+        int (Sink::*scaled)(int) = &Sink::scaled;
+        const void *target = nullptr;
+        memcpy(&target, &scaled, sizeof(target));
+        VERIFY(callsDirectly(reinterpret_cast<const void*>(&staticScaled), target));
+#endif
+    }
+
+    // method indexes follow the declarations, after the ones of the super classes
+    {
+        COMPARE(MetaObject::staticMetaObject.methodOffset(), 0);
+        COMPARE(MetaObject::staticMetaObject.methodCount(), 1);
+        COMPARE(Object::staticMetaObject.methodOffset(), 1);
+        COMPARE(Object::staticMetaObject.methodCount(), 13);
+        COMPARE(Derived::staticMetaObject.methodOffset(), 13);
+        COMPARE(Derived::staticMetaObject.methodCount(), 15);
+        // the tables declare no indexed methods
+        COMPARE(Extended::staticMetaObject.methodOffset(), 13);
+        COMPARE(Extended::staticMetaObject.methodCount(), 13);
+        COMPARE(Sink::staticMetaObject.methodOffset(), 1);
+
+        const int intRetArgFunc = Object::staticMetaObject.indexOfMethod<int, int>("intRetArgFunc");
+        COMPARE(intRetArgFunc, 4);
+        COMPARE((Derived::staticMetaObject.indexOfMethod<int, int>("intRetArgFunc")), 4);
+        COMPARE(Object::staticMetaObject.method(intRetArgFunc)->name(), "intRetArgFunc");
+        COMPARE((Object::staticMetaObject.indexOfMethod<size_t>("intRetArgFunc")), -1);
+        COMPARE((Object::staticMetaObject.indexOfMethod<size_t, int, const vector<int>&>("intRetVectorFunc")), 6);
+        // the redeclared method is found in the derived class first
+        COMPARE((Object::staticMetaObject.indexOfMethod<int, const vector<int>&>("abstractMethod")), 12);
+        COMPARE((MetaObject::staticMetaObject.indexOfMethod<int, const vector<int>&>("abstractMethod")), 0);
+
+        int result = 0;
+        int argument = 7;
+        void *args[] = { &result, &argument };
+        VERIFY(MetaClass::invokeByIndex(object.get(), intRetArgFunc, args));
+        COMPARE(result, 70);
+        VERIFY(MetaClass::invokeByIndex(metaObject, intRetArgFunc, args));
+        // the indexes of virtual methods dispatch to the overrides
+        void *vectorArgs[] = { &result, &v };
+        VERIFY(MetaClass::invokeByIndex(metaObject, 0, vectorArgs));
+        COMPARE(result, 2000);
+        int out = 0;
+        void *outArgs[] = { nullptr, &out };
+        VERIFY(MetaClass::invokeByIndex(object.get(), Object::staticMetaObject.indexOfMethod<void, int&>("outArgFunc"), outArgs));
+        COMPARE(out, 42);
+        VERIFY(!MetaClass::invokeByIndex(object.get(), -1, args));
+        VERIFY(!MetaClass::invokeByIndex(object.get(), 13, args));
+        VERIFY(!Object::staticMetaObject.method(13));
+
+        // the flags of the arguments move them, as with metainvoker::Caller
+        Sink sink;
+        size_t size = 0;
+        vector<int> moved(100, 1);
+        void *sinkArgs[] = { &size, &moved };
+        const int keepVector = Sink::staticMetaObject.indexOfMethod<size_t, vector<int>>("keepVector");
+        VERIFY(MetaClass::invokeByIndex(&sink, keepVector, sinkArgs));
+        VERIFY(size == 100u && moved.size() == 100u);
+        VERIFY(MetaClass::invokeByIndex(&sink, keepVector, sinkArgs, 1));
+        VERIFY(size == 100u && moved.empty());
+        VERIFY(!MetaClass::invokeByIndex(object.get(), keepVector + Object::staticMetaObject.methodCount(), sinkArgs));
+    }
+
+    // batches resolve once per class
+    {
+        MetaObject *objects[] = { object.get(), o2.get(), object.get() };
+        int results[3] = { 0, 0, 0 };
+        COMPARE(MetaClass::invokeBatch<int>(objects, span<int>(results), "abstractMethod", v), 3u);
+        COMPARE(results[0], 1000);
+        COMPARE(results[1], 2000);
+        COMPARE(results[2], 1000);
+        results[1] = 0;
+        objects[1] = extended.get();
+        COMPARE(MetaClass::invokeBatch<int>(objects, span<int>(results), "derivedFunc", 7), 1u);
+        COMPARE(results[1], -7);
+        COMPARE(MetaClass::invokeBatch<int>(objects, "intRetFunc"), 3u);
+        COMPARE(MetaClass::invokeBatch<void>(objects, "voidFunc", 1), 0u);
+
+        vector<MetaObject*> many(20000, object.get());
+        for (size_t i = 0; i < many.size(); i += 2) {
+            many[i] = o2.get();
+        }
+        vector<int> manyResults(many.size());
+        COMPARE(MetaClass::invokeBatchParallel<int>(many, span<int>(manyResults), "abstractMethod", v), many.size());
+        VERIFY(manyResults[0] == 2000 && manyResults[1] == 1000 && manyResults.back() == 1000);
+    }
+
+    // asynchronous calls take their arguments by move
+    {
+        MetaFuture<size_t> f1 = MetaClass::invokeAsync<size_t>(metaObject, "intRetVectorFunc", vector<int>(7));
+        MetaFuture<size_t> f2 = MetaClass::invokeAsync<size_t>(object.get(), "intRetVectorFunc", 2, vector<int>(5));
+        MetaFuture<int> f3 = MetaClass::invokeAsync<int>(object.get(), "derivedFunc", 1);
+        MetaFuture<void> f4 = MetaClass::invokeAsync<void>(object.get(), "intArgFunc", 42);
+        VERIFY(f1.isValid() && f2.isValid() && !f3.isValid() && f4.isValid());
+        COMPARE(f1.get(), 14u);
+        COMPARE(f2.get(), 5u);
+        VERIFY(f3.isReady());
+        f4.wait();
+        VERIFY(f4.isReady());
+        MetaFuture<int> pending = MetaClass::invokeAsync<int>(metaObject, "abstractMethod", v);
+    }
+
+    // the futures can be moved, and the results need no default constructor; get() returns
+    // an optional of those
+    {
+        Sink sink;
+        vector<MetaFuture<Token>> tokens;
+        for (int i = 0; i < 4; ++i) {
+            tokens.push_back(MetaClass::invokeAsync<Token>(&sink, "token", i));
+        }
+        MetaFuture<unique_ptr<int>> made = MetaClass::invokeAsync<unique_ptr<int>>(&sink, "make", 9);
+        MetaFuture<unique_ptr<int>> moved(move(made));
+        VERIFY(!made.isValid() && moved.isValid());
+        for (int i = 0; i < 4; ++i) {
+            optional<Token> token = tokens[size_t(i)].get();
+            VERIFY(token && token->id == i);
+        }
+        unique_ptr<int> result = moved.get();
+        VERIFY(result && *result == 9);
+        MetaFuture<int> unresolved = MetaClass::invokeAsync<int>(&sink, "noSuchMethod", 1);
+        VERIFY(!unresolved.isValid() && unresolved.isReady());
+        COMPARE(unresolved.get(), 0);
+        VERIFY(!made.get());
+        MetaFuture<Token> unresolvedToken = MetaClass::invokeAsync<Token>(&sink, "noSuchMethod", 1);
+        VERIFY(!unresolvedToken.get());
+        MetaFuture<Token> movedToken(move(tokens[0]));
+        VERIFY(!tokens[0].get());
+    }
+
+    // coroutines awaiting the calls, inline and on the thread pool
+    {
+        MetaPoolScheduler scheduler;
+        scheduler.setInline("intRetFunc");
+        vector<int> results;
+        atomic<bool> done = false;
+        awaitCalls(object.get(), scheduler, results, done);
+        while (!done.load(memory_order_acquire)) {
+            this_thread::yield();
+        }
+        VERIFY((results == vector<int> { 40, 100, 0, 3 }));
+
+        Sink sink;
+        results.clear();
+        done = false;
+        awaitTokens(&sink, results, done);
+        while (!done.load(memory_order_acquire)) {
+            this_thread::yield();
+        }
+        VERIFY((results == vector<int> { 7, -1 }));
+    }
+
+    // invocations running concurrently with registrations
+    {
+        atomic<bool> done = false;
+        atomic<size_t> failures = 0;
+        vector<thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&]() {
+                static MetaCallSite<int, int> intRetArgFunc("intRetArgFunc");
+                while (!done.load(memory_order_acquire)) {
+                    int result = 0;
+                    if (!MetaClass::invoke<int>(extended.get(), result, "derivedFunc", 3) || result != -3) {
+                        ++failures;
+                    }
+                    if (!intRetArgFunc.invoke(metaObject, result, 3) || result != 30) {
+                        ++failures;
+                    }
+                    MetaEpoch::Guard guard;
+                    MetaClass::MetaMethodRange range = metaObject->metaObject()->methods("intRetVectorFunc");
+                    if (range.second - range.first != 2) {
+                        ++failures;
+                    }
+                }
+            });
+        }
+        // the failed resolution is memoized until the method is registered
+        VERIFY(!MetaClass::invoke<int>(metaObject, ret, "plugin199", 4));
+        VERIFY(!MetaClass::invoke<int>(metaObject, ret, "plugin199", 4));
+        MetaClass *mo = const_cast<MetaClass*>(&Object::staticMetaObject);
+        for (int i = 0; i < 200; ++i) {
+            mo->addMetaMethod(new MetaMethod<Object, int, int>(&Object::intRetArgFunc,
+                                                               MetaSymbol("plugin" + to_string(i))));
+            this_thread::yield();
+        }
+        done.store(true, memory_order_release);
+        for (thread &reader : readers) {
+            reader.join();
+        }
+        COMPARE(failures.load(), 0u);
+        ret = 0;
+        VERIFY(MetaClass::invoke<int>(metaObject, ret, "plugin199", 4));
+        COMPARE(ret, 40);
+    }
+
+    // call statistics, main is built with METAMETHOD_STATS
+    {
+        MetaStats::setEnabled(true);
+        for (int i = 0; i < 64; ++i) {
+            VERIFY(MetaClass::invoke<int>(object.get(), ret, "intRetFunc"));
+        }
+        VERIFY(!MetaClass::invoke<void>(object.get(), "voidFunc", 10));
+        VERIFY(!MetaClass::invoke<void>(object.get(), "noSuchMethod"));
+        VERIFY(!MetaClass::invoke<void>(object.get(), "noSuchMethod"));
+        VERIFY(!MetaClass::invoke<void>(object.get(), "no \"such\" \\method\n"));
+        MetaStats::setEnabled(false);
+        VERIFY(MetaClass::invoke<int>(object.get(), ret, "intRetFunc"));
+
+        const MetaStats stats = Object::staticMetaObject.stats();
+        auto intRetFunc = find_if(stats.methods.begin(), stats.methods.end(), [](const MetaStats::Method &method) {
+            return method.name == "intRetFunc";
+        });
+        VERIFY(intRetFunc != stats.methods.end());
+        COMPARE(intRetFunc->calls, 64u);
+        COMPARE(accumulate(intRetFunc->latency.begin(), intRetFunc->latency.end(), uint64_t(0)), 64 / MetaStats::SampleRate);
+        VERIFY(intRetFunc->latencySum > 0);
+        COMPARE(stats.misses.size(), 3u);
+        for (const MetaStats::Miss &miss : stats.misses) {
+            COMPARE(miss.count, (miss.name == "noSuchMethod" ? 2u : 1u));
+        }
+
+        FILE *file = tmpfile();
+        stats.writeJson(fileno(file), "Object");
+        stats.writePrometheus(fileno(file), "Object");
+        rewind(file);
+        string exported;
+        char buffer[4096];
+        for (size_t size; (size = fread(buffer, 1, sizeof(buffer), file)) > 0;) {
+            exported.append(buffer, size);
+        }
+        fclose(file);
+        VERIFY(exported.find("{\"class\": \"Object\", \"methods\": [") == 0);
+        VERIFY(exported.find("metamethod_calls_total{class=\"Object\",method=\"intRetFunc\"") != string::npos);
+        VERIFY(exported.find("metamethod_misses_total{class=\"Object\",method=\"noSuchMethod\"} 2") != string::npos);
+        // the names are escaped, the latencies are labeled as sampled, with a sum
+        VERIFY(exported.find("{\"name\": \"no \\\"such\\\" \\\\method\\u000a\", \"count\": 1}") != string::npos);
+        VERIFY(exported.find("method=\"no \\\"such\\\" \\\\method\\n\"} 1") != string::npos);
+        VERIFY(exported.find("metamethod_sampled_latency_ns_sum{class=\"Object\",method=\"intRetFunc\"") != string::npos);
+    }
+
     // dynamic invoke
     VERIFY(MetaClass::invoke(object.get(), "voidFunc"));
+
+    // arguments converted through the conversion matrix, to the cheapest overload
+    {
+        MetaEpoch::Guard guard;
+        COMPARE(MetaConversion::find(MetaType::Int, MetaType::Long).cost, MetaConversion::Promotion);
+        COMPARE(MetaConversion::find(MetaType::Int, MetaType::Double).cost, MetaConversion::Standard);
+        COMPARE(MetaConversion::find(MetaType::typeId<const char*>(), MetaType::String).cost, MetaConversion::UserDefined);
+        COMPARE(MetaConversion::find(MetaType::Double, MetaType::Int).cost, MetaConversion::None);
+        // the conversions which may round are not made
+        COMPARE(MetaConversion::find(MetaType::Int, MetaType::Float).cost, MetaConversion::None);
+        COMPARE(MetaConversion::find(MetaType::Long, MetaType::Double).cost, MetaConversion::None);
+    }
+    {
+        Converting converting;
+        int result = 0;
+        VERIFY(MetaClass::invoke<int>(&converting, result, "overload", 5));
+        COMPARE(result, 1);
+        VERIFY(MetaClass::invoke<int>(&converting, result, "overload", 1.5f));
+        COMPARE(result, 2);
+        VERIFY(MetaClass::invoke<int>(&converting, result, "sum", vector<int> { 1, 2, 3 }));
+        COMPARE(result, 6);
+        VERIFY(MetaClass::invoke<int>(object.get(), result, "intRetArgFunc", short(4)));
+        COMPARE(result, 40);
+        // no narrowing conversions
+        VERIFY(!MetaClass::invoke<int>(object.get(), result, "intRetArgFunc", 2.5));
+
+        // the conversions of the user types are added to the matrix
+        struct Pair
+        {
+            int first;
+            int second;
+            operator Point() const { return Point { first, second }; }
+        };
+        VERIFY(!MetaClass::invoke<int>(&converting, result, "pointWidth", Pair { 7, 8 }));
+        MetaConversion::add<Pair, Point>();
+        VERIFY(MetaClass::invoke<int>(&converting, result, "pointWidth", Pair { 7, 8 }));
+        COMPARE(result, 7);
+
+        static MetaCallSite<int, short> overloadSite("overload");
+        result = 0;
+        VERIFY(overloadSite.invoke(&converting, result, 3));
+        COMPARE(result, 1);
+
+        MetaValue value;
+        MetaValue args[] = { 3 };
+        VERIFY(MetaClass::invoke(&converting, "overload", value, args));
+        COMPARE(*value.value<int>(), 1);
+        MetaValue text[] = { "meta" };
+        VERIFY(MetaClass::invoke(object.get(), "voidStringFunc", value, text));
+    }
+
+    // values of any registered type, stored inline up to MetaValue::InlineSize
+    {
+        COMPARE(sizeof(MetaValue), 32u);
+        MetaValue empty;
+        VERIFY(!empty.isValid());
+        MetaValue i = 5;
+        VERIFY(i.isInline());
+        COMPARE(*i.value<int>(), 5);
+        VERIFY(!i.value<long>());
+        MetaValue p = Point { 1, 2 };
+        VERIFY(p.clone() == p);
+        VERIFY(!(p == i));
+        MetaValue large = array<int, 20>();
+        VERIFY(!large.isInline());
+        MetaValue moved = move(large);
+        VERIFY((!large.isValid() && moved.value<array<int, 20>>()));
+
+        // move-only values are moved, and not cloned
+        MetaValue h = Handle { make_unique<int>(7) };
+        MetaValue h2 = move(h);
+        VERIFY(!h.isValid());
+        COMPARE(*h2.value<Handle>()->value, 7);
+        VERIFY(!h2.clone().isValid());
+
+        // a value whose construction throws leaves the MetaValue empty
+        MetaValue thrown = 5;
+        bool caught = false;
+        try {
+            thrown.emplace<Throwing<4>>(1);
+        } catch (const runtime_error &) {
+            caught = true;
+        }
+        VERIFY(caught && !thrown.isValid());
+        caught = false;
+        try {
+            thrown.emplace<Throwing<100>>(1);
+        } catch (const runtime_error &) {
+            caught = true;
+        }
+        VERIFY(caught && !thrown.isValid());
+        caught = false;
+        try {
+            thrown.construct(MetaType::typeId<string>(), [](void *) { throw runtime_error("not constructed"); });
+        } catch (const runtime_error &) {
+            caught = true;
+        }
+        VERIFY(caught && !thrown.isValid());
+        thrown.emplace<string>("after");
+        COMPARE(*thrown.value<string>(), string("after"));
+    }
+
+    // dynamic invoke with MetaValue arguments and return value
+    {
+        MetaValue result;
+        MetaValue args[] = { 5 };
+        VERIFY(MetaClass::invoke(object.get(), "intRetArgFunc", result, args));
+        COMPARE(*result.value<int>(), 50);
+        VERIFY(MetaClass::invoke(object.get(), "voidFunc", result));
+        VERIFY(!result.isValid());
+        MetaValue wrongType[] = { string("5") };
+        VERIFY(!MetaClass::invoke(object.get(), "intRetArgFunc", result, wrongType));
+
+        MetaValue vectorArgs[] = { 3, vector<int> { 1, 2 } };
+        VERIFY(MetaClass::invoke(object.get(), "intRetVectorFunc2", result, vectorArgs));
+        COMPARE(*result.value<int>(), 6);
+        {
+            MetaValue stringArgs[] = { string("meta value") };
+            VERIFY(MetaClass::invoke(object.get(), "voidStringFunc", result, stringArgs));
+        }
+
+        // no heap allocations once the blocks of the larger values are recycled
+        const size_t allocations = allocationCount;
+        for (int n = 0; n < 10; ++n) {
+            MetaValue scalar[] = { n };
+            VERIFY(MetaClass::invoke(object.get(), "intRetArgFunc", result, scalar));
+            MetaValue text[] = { string("short string") };
+            VERIFY(MetaClass::invoke(object.get(), "voidStringFunc", result, text));
+        }
+        COMPARE(allocationCount - allocations, 0u);
+    }
+
+    // the blocks freed on other threads go back to the thread which allocated them
+    {
+        vector<void*> blocks;
+        for (int i = 0; i < 8; ++i) {
+            blocks.push_back(MetaBlockAllocator::allocate(100));
+        }
+        void *orphan = nullptr;
+        thread([&blocks, &orphan]() {
+            for (void *block : blocks) {
+                MetaBlockAllocator::deallocate(block, 100);
+            }
+            orphan = MetaBlockAllocator::allocate(100);
+        }).join();
+        // the thread which allocated it exited, the block goes back to the heap
+        MetaBlockAllocator::deallocate(orphan, 100);
+        const size_t allocations = allocationCount;
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            void *block = MetaBlockAllocator::allocate(100);
+            VERIFY(find(blocks.begin(), blocks.end(), block) != blocks.end());
+            blocks[i] = block;
+        }
+        COMPARE(allocationCount - allocations, 0u);
+        for (void *block : blocks) {
+            MetaBlockAllocator::deallocate(block, 100);
+        }
+    }
+
+    // untyped invokes, the arguments point to the values
+    {
+        int i = 5;
+        ret = -1;
+        VERIFY(MetaClass::invoke(object.get(), "intRetArgFunc", RET_ARG(int, ret), { ARG(int, i) }));
+        COMPARE(ret, 50);
+        VERIFY(MetaClass::invoke(object.get(), "voidFunc"));
+        // the return value can be ignored
+        VERIFY(MetaClass::invoke(object.get(), "intRetArgFunc", ReturnArgumentBase(), { ARG(int, i) }));
+        const vector<int> values { 1, 2, 3 };
+        VERIFY(MetaClass::invoke(object.get(), "intRetVectorFunc2", RET_ARG(int, ret), { ARG(int, i), ARG(vector<int>, values) }));
+        COMPARE(ret, 15);
+        int out = 0;
+        VERIFY(MetaClass::invoke(object.get(), "outArgFunc", ReturnArgumentBase(), { ARG(int&, out) }));
+        COMPARE(out, 42);
+        // the non-const references take no values
+        VERIFY(!MetaClass::invoke(object.get(), "outArgFunc", ReturnArgumentBase(), { ARG(int, out) }));
+
+        int a[10] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+        VERIFY(MetaClass::invoke(object.get(), "tenArgsFunc", RET_ARG(int, ret),
+                                 { ARG(int, a[0]), ARG(int, a[1]), ARG(int, a[2]), ARG(int, a[3]), ARG(int, a[4]),
+                                   ARG(int, a[5]), ARG(int, a[6]), ARG(int, a[7]), ARG(int, a[8]), ARG(int, a[9]) }));
+        COMPARE(ret, 55);
+        vector<ArgumentBase> args;
+        for (int &value : a) {
+            args.push_back(ARG(int, value));
+        }
+        ret = -1;
+        VERIFY(MetaClass::invoke(object.get(), "tenArgsFunc", RET_ARG(int, ret), args));
+        COMPARE(ret, 55);
+        MetaValue result;
+        MetaValue valueArgs[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+        VERIFY(MetaClass::invoke(object.get(), "tenArgsFunc", result, valueArgs));
+        COMPARE(*result.value<int>(), 55);
+
+        // the types of the arguments and of the return value must match
+        const double d = 5;
+        VERIFY(!MetaClass::invoke(object.get(), "intRetArgFunc", RET_ARG(int, ret), { ARG(double, d) }));
+        long l = 0;
+        VERIFY(!MetaClass::invoke(object.get(), "intRetArgFunc", RET_ARG(long, l), { ARG(int, i) }));
+        VERIFY(!MetaClass::invoke(object.get(), "intRetArgFunc", RET_ARG(int, ret), { ARG(int, i), ARG(int, i) }));
+    }
+
+    // remote invokes, the server runs on a thread of its own
+    auto remoteCalls = [](auto transports) {
+        VERIFY(transports.first && transports.second);
+        Remote remote;
+        MetaWireServer server;
+        const uint32_t id = server.add(&remote);
+        thread serving([&]() {
+            while (server.serve(*transports.second)) {
+            }
+        });
+        {
+            MetaWireClient client(*transports.first);
+            int i = 0;
+            VERIFY((client.call<int, int, double>(id, "scale", i, 7, 1.5) == MetaWire::Ok));
+            COMPARE(i, 10);
+            size_t length = 0;
+            VERIFY((client.call<size_t, string_view>(id, "textLength", length, "zero copy") == MetaWire::Ok));
+            COMPARE(length, 9u);
+            vector<int> values { 1, 2, 3, 4 };
+            VERIFY((client.call<int, span<const int>>(id, "sum", i, values) == MetaWire::Ok));
+            COMPARE(i, 10);
+            string greeting;
+            VERIFY((client.call<string, const string&>(id, "greet", greeting, "wire") == MetaWire::Ok));
+            COMPARE(greeting, "hello wire");
+            vector<int> range;
+            VERIFY((client.call<vector<int>, int>(id, "range", range, 3) == MetaWire::Ok));
+            VERIFY((range == vector<int> { 0, 1, 2 }));
+            Point p;
+            VERIFY((client.call<Point, Point>(id, "mirror", p, Point { 1, 2 }) == MetaWire::Ok));
+            VERIFY((p == Point { 2, 1 }));
+            VERIFY((client.call<void, int>(id, "store", 42) == MetaWire::Ok));
+            COMPARE(remote.stored, 42);
+
+            // the signature must match the declaration exactly
+            VERIFY((client.call<int, long, double>(id, "scale", i, 7, 1.5) == MetaWire::NoMethod));
+            VERIFY((client.call<int, int, double>(id + 1, "scale", i, 7, 1.5) == MetaWire::NoObject));
+            // the declared types are checked, not only the signature hash; the values end the
+            // request
+            const auto forged = [&](bool declared, bool trailing) {
+                MetaWire::Writer writer;
+                MetaWire::Header &header = writer.begin();
+                header = MetaWire::Header();
+                header.status = MetaWire::Request;
+                header.symbol = MetaSymbol("scale").id();
+                header.signatureHash = arguments::signatureHash<int, int, double>();
+                header.object = id;
+                if (declared) {
+                    writer.writeTypes<int, int, double>();
+                } else {
+                    writer.writeTypes<int, float, double>();
+                }
+                writer.write<int>(7);
+                writer.write<double>(1.5);
+                if (trailing) {
+                    writer.write<int>(0);
+                }
+                VERIFY(transports.first->send(writer.finish()));
+                return client.result(&i);
+            };
+            VERIFY((forged(true, false) == MetaWire::Ok));
+            COMPARE(i, 10);
+            VERIFY((forged(false, false) == MetaWire::NoMethod));
+            VERIFY((forged(true, true) == MetaWire::BadMessage));
+
+            // more calls on the way
+            for (int n = 0; n < 16; ++n) {
+                VERIFY((client.post<int, int, double>(id, "scale", n, 2.0)));
+            }
+            for (int n = 0; n < 16; ++n) {
+                VERIFY((client.result(&i) == MetaWire::Ok && i == 2 * n));
+            }
+
+            // the views of the messages are passed on, the warm calls allocate nothing
+            const size_t allocations = allocationCount;
+            for (int n = 0; n < 10; ++n) {
+                VERIFY((client.call<size_t, string_view>(id, "textLength", length, "a longer text than the small string") == MetaWire::Ok));
+                VERIFY((client.call<int, span<const int>>(id, "sum", i, values) == MetaWire::Ok));
+                VERIFY((client.call<int, int, double>(id, "scale", i, n, 1.0) == MetaWire::Ok));
+            }
+            COMPARE(allocationCount - allocations, 0u);
+        }
+        // closing the client end stops the server
+        transports.first.reset();
+        serving.join();
+    };
+    remoteCalls(MetaSocketTransport::createPair());
+    remoteCalls(MetaRingTransport::createPair());
+
+    // a send waiting for room in the ring fails once the other end is closed
+    {
+        auto ends = MetaRingTransport::createPair();
+        const vector<char> message(MetaRingTransport::Capacity / 4, 'x');
+        VERIFY(ends.first->send(message));
+        VERIFY(!ends.second->receive().empty());
+        atomic<int> sent = 0;
+        thread sender([&]() {
+            while (ends.first->send(message)) {
+                ++sent;
+            }
+        });
+        // the ring fills up, nothing is received any more
+        this_thread::sleep_for(chrono::milliseconds(20));
+        ends.second.reset();
+        sender.join();
+        VERIFY(sent.load() > 0);
+        VERIFY(!ends.first->send(message));
+    }
+
+    // the raw bools received are validated; the enums, and the structs which are not
+    // MetaRawValue, are not sent
+    {
+        enum class Color { Red, Green };
+        struct Flagged { int value; bool flag; };
+        VERIFY((MetaWire::encoding<Color>() == MetaWire::Encoding::None));
+        VERIFY((MetaWire::encoding(arguments::ArgumentType::value<Color>()) == MetaWire::Encoding::None));
+        VERIFY((MetaWire::encoding<pair<const char*, int>>() == MetaWire::Encoding::None));
+        VERIFY((MetaWire::encoding(arguments::ArgumentType::value<pair<const char*, int>>()) == MetaWire::Encoding::None));
+        VERIFY((MetaWire::encoding<span<char>>() == MetaWire::Encoding::None));
+        VERIFY((MetaWire::encoding(arguments::ArgumentType::value<Flagged>()) == MetaWire::Encoding::None));
+        VERIFY((MetaWire::encoding(arguments::ArgumentType::value<Point>()) == MetaWire::Encoding::Raw));
+        VERIFY((MetaWire::encoding(arguments::ArgumentType::value<double>()) == MetaWire::Encoding::Raw));
+        MetaWire::Writer writer;
+        writer.begin();
+        writer.write<bool>(true);
+        const span<const char> message = writer.finish();
+        vector<char> bytes(message.begin(), message.end());
+        MetaValue slot;
+        bool value = false;
+        MetaWire::Reader valid(bytes);
+        VERIFY(valid.read(arguments::ArgumentType::value<bool>(), slot) != nullptr);
+        bytes.back() = 2;
+        MetaWire::Reader invalid(bytes);
+        VERIFY(invalid.read(arguments::ArgumentType::value<bool>(), slot) == nullptr);
+        MetaWire::Reader typed(bytes);
+        VERIFY(!typed.read(value));
+        VERIFY(!value);
+    }
+
+    // the metadata image of the classes initialized so far
+    {
+        unique_ptr<TabledLeaf> leaf(Object::create<TabledLeaf>());
+        VERIFY(MetaClass::invoke<int>(leaf.get(), ret, "leafFunc", 1));
+        const string path = "/tmp/metamethod-" + to_string(getpid()) + ".image";
+        VERIFY(MetaImage::write(path));
+        unique_ptr<MetaImage> image = MetaImage::open(path);
+        VERIFY(image);
+
+        const uint32_t tabled = image->findClass("Tabled");
+        VERIFY(tabled != MetaImage::NoClass);
+        VERIFY(image->findClass("NoSuchClass") == MetaImage::NoClass);
+        const MetaImage::Class &c = image->classes()[tabled];
+        COMPARE(image->text(image->classes()[c.super].name), "Object");
+        size_t vectorFuncs = 0;
+        for (const MetaImage::Method &method : image->methods(c)) {
+            if (image->text(method.name) == "intRetVectorFunc") {
+                // the override first, then the inherited overload
+                COMPARE(method.owner, vectorFuncs);
+                ++vectorFuncs;
+            } else if (image->text(method.name) == "tripled") {
+                span<const arguments::ArgumentType> types = image->arguments(method);
+                COMPARE(types.size(), 2u);
+                COMPARE(types[0].typeId(), int(MetaType::Int));
+                COMPARE(image->text(image->type(types[1]).name), typeid(int).name());
+            }
+        }
+        COMPARE(vectorFuncs, 2u);
+
+        // the constexpr tables are looked up in the installed image
+        MetaImage::install(image.get());
+        VERIFY(Tabled::staticMetaObject.isImageBacked());
+        VERIFY(TabledLeaf::staticMetaObject.isImageBacked());
+        VERIFY(!Object::staticMetaObject.isImageBacked());
+        // runtime registrations keep the class off the image
+        VERIFY(!Extended::staticMetaObject.isImageBacked());
+        ret = 0;
+        VERIFY(MetaClass::invoke<int>(leaf.get(), ret, "leafFunc", 4));
+        COMPARE(ret, -4);
+        VERIFY(MetaClass::invoke<int>(leaf.get(), ret, "tripled", 4));
+        COMPARE(ret, 12);
+        VERIFY(MetaClass::invoke<int>(leaf.get(), ret, "intRetArgFunc", 4));
+        COMPARE(ret, 40);
+        uret = 0;
+        VERIFY(MetaClass::invoke<size_t>(leaf.get(), uret, "intRetVectorFunc", v));
+        COMPARE(uret, 30);
+        VERIFY(MetaClass::invoke<size_t>(leaf.get(), uret, "intRetVectorFunc", 1, v));
+        COMPARE(uret, 10);
+        VERIFY(!MetaClass::invoke<int>(leaf.get(), ret, "derivedFunc", 4));
+        {
+            MetaEpoch::Guard guard;
+            MetaClass::MetaMethodRange declared = Tabled::staticMetaObject.declaredMethods("intRetVectorFunc");
+            COMPARE(declared.second - declared.first, 1);
+        }
+
+        MetaImage::install(nullptr);
+        VERIFY(!TabledLeaf::staticMetaObject.isImageBacked());
+        VERIFY(MetaClass::invoke<int>(leaf.get(), ret, "tripled", 5));
+        COMPARE(ret, 15);
+
+        // images which are not valid are refused
+        VERIFY(!MetaImage::open("/tmp/no-such-metamethod.image"));
+        if (FILE *file = fopen(path.c_str(), "r+b")) {
+            const uint32_t version = MetaImage::Version + 1;
+            fseek(file, offsetof(MetaImage::Header, version), SEEK_SET);
+            fwrite(&version, sizeof(version), 1, file);
+            fclose(file);
+        }
+        VERIFY(!MetaImage::open(path));
+        remove(path.c_str());
+    }
     return 0;
 }
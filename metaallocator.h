@@ -0,0 +1,186 @@
+#ifndef METAALLOCATOR_H
+#define METAALLOCATOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Recycles small blocks, such as coroutine frames and the values of MetaValue. The blocks
+/// are kept in per thread free lists of 64 byte size classes, so the allocations do not go
+/// to the heap once warm. A block goes back to the thread which allocated it: the blocks
+/// freed on other threads are pushed to a lock-free list of the owner, which takes them
+/// back when its own list runs empty. The lists are capped, the blocks above the cap go
+/// back to the heap.
+///
+class MetaBlockAllocator
+{
+    static constexpr size_t Granularity = 64;
+    // blocks up to 1 KiB are recycled
+    static constexpr size_t SizeClasses = 16;
+    // the bytes of free blocks kept per size class and thread
+    static constexpr size_t MaxFreeBytes = 1 << 20;
+
+    struct Owner;
+    // precedes the memory handed out, keeps its alignment
+    struct alignas(max_align_t) Header
+    {
+        Owner *owner;
+        size_t sizeClass;
+    };
+    // a free block, in the memory handed out
+    struct Block
+    {
+        Block *next;
+    };
+
+    // the free lists of a thread; it outlives the thread until the blocks allocated on it
+    // are all freed
+    struct Owner
+    {
+        Block *heads[SizeClasses] = {};
+        size_t counts[SizeClasses] = {};
+        // the blocks freed on other threads, abandonedMark() once the thread exited
+        atomic<Block*> remote = nullptr;
+        // the blocks handed out by the thread and not back in its lists
+        size_t live = 0;
+        // the live blocks left when the thread exited, less the ones freed since
+        atomic<ptrdiff_t> abandoned = 0;
+
+        static Block *abandonedMark()
+        {
+            return reinterpret_cast<Block*>(uintptr_t(1));
+        }
+
+        void keep(Block *block, size_t sizeClass)
+        {
+            --live;
+            if (counts[sizeClass - 1] < MaxFreeBytes / (sizeClass * Granularity)) {
+                block->next = heads[sizeClass - 1];
+                heads[sizeClass - 1] = block;
+                ++counts[sizeClass - 1];
+            } else {
+                ::operator delete(headerOf(block));
+            }
+        }
+
+        // takes back the blocks freed on other threads
+        void drain()
+        {
+            Block *block = remote.exchange(nullptr, memory_order_acquire);
+            while (block) {
+                Block *next = block->next;
+                keep(block, headerOf(block)->sizeClass);
+                block = next;
+            }
+        }
+
+        // with the thread exiting
+        void abandon()
+        {
+            Block *block = remote.exchange(abandonedMark(), memory_order_acquire);
+            while (block) {
+                Block *next = block->next;
+                --live;
+                ::operator delete(headerOf(block));
+                block = next;
+            }
+            for (size_t i = 0; i < SizeClasses; ++i) {
+                while (Block *head = heads[i]) {
+                    heads[i] = head->next;
+                    ::operator delete(headerOf(head));
+                }
+            }
+            const ptrdiff_t left = ptrdiff_t(live);
+            if (abandoned.fetch_add(left, memory_order_acq_rel) + left == 0) {
+                delete this;
+            }
+        }
+
+        // a block of the owner freed on another thread
+        void release(Block *block)
+        {
+            Block *head = remote.load(memory_order_relaxed);
+            do {
+                if (head == abandonedMark()) {
+                    ::operator delete(headerOf(block));
+                    if (abandoned.fetch_sub(1, memory_order_acq_rel) == 1) {
+                        delete this;
+                    }
+                    return;
+                }
+                block->next = head;
+            } while (!remote.compare_exchange_weak(head, block, memory_order_release, memory_order_relaxed));
+        }
+    };
+
+    struct ThreadOwner
+    {
+        Owner *owner = new Owner;
+
+        ~ThreadOwner()
+        {
+            owner->abandon();
+        }
+    };
+
+    static Owner *owner()
+    {
+        static thread_local ThreadOwner thread;
+        return thread.owner;
+    }
+
+    static Header *headerOf(void *p)
+    {
+        return static_cast<Header*>(p) - 1;
+    }
+
+    static size_t sizeClassOf(size_t size)
+    {
+        return (size + sizeof(Header) + Granularity - 1) / Granularity;
+    }
+
+public:
+    static void *allocate(size_t size)
+    {
+        const size_t sizeClass = sizeClassOf(size);
+        if (sizeClass > SizeClasses) {
+            return ::operator new(size);
+        }
+        Owner *own = owner();
+        if (!own->heads[sizeClass - 1] && own->remote.load(memory_order_relaxed)) {
+            own->drain();
+        }
+        ++own->live;
+        if (Block *block = own->heads[sizeClass - 1]) {
+            own->heads[sizeClass - 1] = block->next;
+            --own->counts[sizeClass - 1];
+            return block;
+        }
+        Header *header = static_cast<Header*>(::operator new(sizeClass * Granularity));
+        header->owner = own;
+        header->sizeClass = sizeClass;
+        return header + 1;
+    }
+
+    static void deallocate(void *p, size_t size)
+    {
+        if (sizeClassOf(size) > SizeClasses) {
+            ::operator delete(p);
+            return;
+        }
+        Header *header = headerOf(p);
+        Block *block = static_cast<Block*>(p);
+        Owner *own = owner();
+        if (header->owner == own) {
+            own->keep(block, header->sizeClass);
+        } else {
+            header->owner->release(block);
+        }
+    }
+};
+
+#endif // METAALLOCATOR_H
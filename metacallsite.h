@@ -0,0 +1,162 @@
+#ifndef METACALLSITE_H
+#define METACALLSITE_H
+
+#include <atomic>
+#include <mutex>
+
+#include "metaclass.h"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// MetaCallSite caches the method resolved for a call with a fixed name, return type
+/// and argument types, keyed by the MetaClass of the object it is invoked on. Meant to
+/// be used as a static local at the call site:
+///
+///     static MetaCallSite<int, int> intRetArgFunc("intRetArgFunc");
+///     intRetArgFunc.invoke(object, ret, 5);
+///
+/// The first slot is the monomorphic cache, the rest form the polymorphic cache. Once
+/// all slots are taken, calls on further classes take the MetaClass::invoke() path.
+/// Failed resolutions are cached too. The cache is dropped when methods are registered.
+///
+/// Lookups are lock free, guarded by a sequence counter; slots are filled under a lock.
+///
+template<typename TReturnType, typename... Arguments>
+class MetaCallSite
+{
+    static constexpr size_t CacheSize = 4;
+
+    struct Entry
+    {
+        atomic<const MetaClass*> metaClass = nullptr;
+        atomic<const MetaMethodRecord*> method = nullptr;
+    };
+
+    const MetaSymbol m_name;
+    Entry m_cache[CacheSize];
+    atomic<size_t> m_size = 0;
+    atomic<size_t> m_generation = 0;
+    // odd while the cache is updated
+    atomic<size_t> m_sequence = 0;
+    mutex m_lock;
+
+    // returns true if the cache holds the resolution for the class
+    bool lookup(const MetaClass *metaClass, const MetaMethodRecord *&method) const
+    {
+        const size_t sequence = m_sequence.load(memory_order_acquire);
+        if (sequence & 1) {
+            return false;
+        }
+        bool found = false;
+        if (m_generation.load(memory_order_relaxed) == MetaClass::generation()) {
+            for (const Entry &entry : m_cache) {
+                const MetaClass *cached = entry.metaClass.load(memory_order_relaxed);
+                if (cached == metaClass) {
+                    method = entry.method.load(memory_order_relaxed);
+                    found = true;
+                    break;
+                } else if (!cached) {
+                    break;
+                }
+            }
+        }
+        atomic_thread_fence(memory_order_acquire);
+        return found && m_sequence.load(memory_order_relaxed) == sequence;
+    }
+
+    const MetaMethodRecord *resolve(const MetaClass *metaClass)
+    {
+        constexpr arguments::ArgContainer argTypes = arguments::signature<Arguments...>();
+        constexpr uint64_t signatureHash = arguments::signatureHash<TReturnType, Arguments...>();
+        const MetaMethodRecord *method = metaClass->getMethod<TReturnType>(m_name, argTypes, signatureHash);
+        const size_t generation = MetaClass::generation();
+        if (m_size.load(memory_order_relaxed) == CacheSize && m_generation.load(memory_order_relaxed) == generation) {
+            // megamorphic call site
+            return method;
+        }
+
+        lock_guard<mutex> lock(m_lock);
+        m_sequence.fetch_add(1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+
+        if (m_generation.load(memory_order_relaxed) != generation) {
+            for (Entry &entry : m_cache) {
+                entry.metaClass.store(nullptr, memory_order_relaxed);
+                entry.method.store(nullptr, memory_order_relaxed);
+            }
+            m_size.store(0, memory_order_relaxed);
+            m_generation.store(generation, memory_order_relaxed);
+        }
+        const size_t size = m_size.load(memory_order_relaxed);
+        if (size < CacheSize) {
+            m_cache[size].method.store(method, memory_order_relaxed);
+            m_cache[size].metaClass.store(metaClass, memory_order_relaxed);
+            m_size.store(size + 1, memory_order_relaxed);
+        }
+
+        m_sequence.fetch_add(1, memory_order_release);
+        return method;
+    }
+
+    const MetaMethodRecord *resolved(MetaObject *o)
+    {
+        const MetaClass *metaClass = o->metaObject();
+        const MetaMethodRecord *method = nullptr;
+        if (!lookup(metaClass, method)) {
+            method = resolve(metaClass);
+        }
+        return method;
+    }
+
+    // the calls with no exact overload convert their arguments, see MetaClass::getConvertedMethod()
+    bool convertedCall(MetaObject *o, void *ret, Arguments &&...args)
+    {
+        constexpr arguments::ArgContainer argTypes = arguments::signature<Arguments...>();
+        constexpr uint64_t signatureHash = arguments::signatureHash<TReturnType, Arguments...>();
+        MetaConversion::Plan plan;
+        const MetaMethodRecord *method = o->metaObject()->getConvertedMethod<TReturnType>(m_name, argTypes, signatureHash, plan);
+        if (method) {
+            MetaClass::callConverted(method, plan, o, ret, forward<Arguments>(args)...);
+            return true;
+        }
+        return false;
+    }
+
+public:
+    explicit MetaCallSite(MetaSymbol name)
+        : m_name(name)
+    {
+    }
+
+    bool invoke(MetaObject *o, Arguments... args)
+    {
+        const MetaMethodRecord *method = resolved(o);
+        if (method) {
+            method->call(o, nullptr, forward<Arguments>(args)...);
+            return true;
+        }
+        if (convertedCall(o, nullptr, forward<Arguments>(args)...)) {
+            return true;
+        }
+        metastats::recordMiss(o->metaObject(), m_name);
+        return false;
+    }
+
+    template<typename TRet = TReturnType>
+    typename enable_if<!is_void<TRet>::value, bool>::type invoke(MetaObject *o, TRet &ret, Arguments... args)
+    {
+        const MetaMethodRecord *method = resolved(o);
+        if (method) {
+            method->call(o, &ret, forward<Arguments>(args)...);
+            return true;
+        }
+        if (convertedCall(o, &ret, forward<Arguments>(args)...)) {
+            return true;
+        }
+        metastats::recordMiss(o->metaObject(), m_name);
+        return false;
+    }
+};
+
+#endif // METACALLSITE_H
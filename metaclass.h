@@ -4,10 +4,24 @@
 #include <vector>
 #include <memory>
 #include <map>
+#include <unordered_map>
 #include <functional>
 #include <typeindex>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <tuple>
+#include <span>
+#include <optional>
 
 #include "metatype.h"
+#include "metavalue.h"
+#include "metaconversion.h"
+#include "metasymbol.h"
+#include "metaepoch.h"
+#include "metathreadpool.h"
+#include "metastats.h"
 #include "function_traits.h"
 #include "arguments.h"
 #include "invokers.h"
@@ -21,49 +35,227 @@ class MetaObject;
 namespace metainvoker
 {
 
-typedef void (*Invoker)(MetaObject*, ReturnArgumentBase ret, vector<ArgumentBase>);
+// the Caller flag telling that ret points to uninitialized storage, the return value is
+// constructed in it instead of assigned to it
+constexpr uint64_t ConstructReturn = uint64_t(1) << 63;
 
-template <class TClass, typename Ret, Ret (TClass::*Fun)()>
-void invoker (MetaObject *object, ReturnArgumentBase ret, vector<ArgumentBase>)
+// the Caller flags of the arguments passed as non-const rvalues; the callee moves those into
+// its by-value parameters, and copies the others
+template <typename... Arguments>
+constexpr uint64_t movable()
 {
-    (static_cast<TClass*>(object)->*Fun)();
+    static_assert(sizeof... (Arguments) < 63, "too many arguments");
+    uint64_t flags = 0;
+    uint64_t bit = 1;
+    ((flags |= (!is_lvalue_reference<Arguments>::value && !is_const<typename remove_reference<Arguments>::type>::value) ? bit : 0,
+      bit <<= 1), ...);
+    return flags;
 }
 
-template <class TClass, typename Ret, typename T1, Ret (TClass::*Fun)(T1)>
-void invoker (MetaObject *object, ReturnArgumentBase ret, vector<ArgumentBase>)
+// the flags of the by-value parameters which cannot be copied; the calls leaving one of those
+// unflagged are not made
+template <typename... Args>
+constexpr uint64_t moveOnly()
 {
+    uint64_t flags = 0;
+    uint64_t bit = 1;
+    ((flags |= (!is_reference<Args>::value && !is_copy_constructible<typename remove_cv<Args>::type>::value) ? bit : 0,
+      bit <<= 1), ...);
+    return flags;
 }
 
-template <class TClass, typename Ret, typename T1, typename T2, Ret (TClass::*Fun)(T1, T2)>
-void invoker (MetaObject *object, ReturnArgumentBase ret, vector<ArgumentBase>)
+// the type an argument is forwarded as; the arrays decay to pointers, as when passed by value
+template <typename T>
+struct Forwarded
 {
+    typedef typename conditional<is_array<typename remove_reference<T>::type>::value, typename decay<T>::type, T>::type type;
+};
 
+template <typename T>
+inline decltype(auto) forwardArgument(typename remove_reference<T>::type &value)
+{
+    if constexpr (is_array<typename remove_reference<T>::type>::value) {
+        return static_cast<typename decay<T>::type>(value);
+    } else {
+        return static_cast<T&&>(value);
+    }
 }
 
+// calls the method pointed by method, see Call::Method, with its arguments passed as pointers
+// to the argument values, moving the arguments flagged as movable; the return value is assigned
+// to ret, or constructed in it with ConstructReturn, unless ret is null. The method is not
+// called when a by-value parameter which cannot be copied is not flagged, see moveOnly()
+typedef void (*Caller)(const void *method, MetaObject *object, void *ret, void **args, uint64_t flags);
+
+// the same with the arguments given as ArgumentBase, which point to the argument values
+typedef void (*Invoker)(const void *method, MetaObject *object, void *ret, span<const ArgumentBase> args);
+
+// the thunks of a signature, shared by the methods of all the classes with that signature; the
+// method they call is data, its member pointer with the class erased to MetaObject
+template <typename Ret, typename... Args>
+struct Call
+{
+    typedef Ret (MetaObject::*Method)(Args...);
+
+    // the erased member pointer of Fun, the methods pass its address to the thunks
+    template <class TClass, Ret (TClass::*Fun)(Args...)>
+    static constexpr Method method = static_cast<Method>(Fun);
+
+    static void caller(const void *method, MetaObject *object, void *ret, void **args, uint64_t flags)
+    {
+        call(*static_cast<const Method*>(method), object, ret, [args](size_t i) {
+            return args[i];
+        }, flags, index_sequence_for<Args...>());
+    }
+
+    static void invoker(const void *method, MetaObject *object, void *ret, span<const ArgumentBase> args)
+    {
+        call(*static_cast<const Method*>(method), object, ret, [args](size_t i) {
+            return const_cast<void*>(args[i].data());
+        }, 0, index_sequence_for<Args...>());
+    }
+
+    // the caller of a method known at compile time, inlined in the staticMetacall switch
+    template <class TClass, Ret (TClass::*Fun)(Args...)>
+    static inline void direct(MetaObject *object, void *ret, void **args, uint64_t flags)
+    {
+        call(method<TClass, Fun>, object, ret, [args](size_t i) {
+            return args[i];
+        }, flags, index_sequence_for<Args...>());
+    }
+
+    // the thunks of the method Fun: its own, which inline the method, or with
+    // METAMETHOD_SHARED_THUNKS the ones of the signature, less code for an indirect call
+    template <class TClass, Ret (TClass::*Fun)(Args...)>
+    struct Thunks
+    {
+#if defined(METAMETHOD_SHARED_THUNKS)
+        static constexpr Caller caller = &Call::caller;
+        static constexpr Invoker invoker = &Call::invoker;
+#else
+        static void caller(const void *, MetaObject *object, void *ret, void **args, uint64_t flags)
+        {
+            direct<TClass, Fun>(object, ret, args, flags);
+        }
+
+        static void invoker(const void *, MetaObject *object, void *ret, span<const ArgumentBase> args)
+        {
+            call(method<TClass, Fun>, object, ret, [args](size_t i) {
+                return const_cast<void*>(args[i].data());
+            }, 0, index_sequence_for<Args...>());
+        }
+#endif
+    };
+
+private:
+    // the parameter initialized from the value; the by-value parameters are moved into when
+    // movable, the reference parameters bind to the value
+    template <typename Arg>
+    static decltype(auto) parameter(void *value, bool movable)
+    {
+        typedef typename remove_reference<Arg>::type Value;
+        Value &v = *static_cast<Value*>(value);
+        if constexpr (is_reference<Arg>::value) {
+            return static_cast<Arg&&>(v);
+        } else if constexpr (is_trivially_copyable<Value>::value) {
+            (void)(movable);
+            return Value(move(v));
+        } else if constexpr (!is_copy_constructible<Value>::value) {
+            // flagged movable, see moveOnly()
+            (void)(movable);
+            return Value(move(v));
+        } else {
+            if (movable) {
+                return Value(move(v));
+            }
+            return Value(v);
+        }
+    }
+
+    // argument(i) is the address of the i-th argument value
+    template <typename Argument, size_t... Indexes>
+    static void call(Method method, MetaObject *object, void *ret, Argument argument, uint64_t flags, index_sequence<Indexes...>)
+    {
+        (void)(argument);
+        (void)(flags);
+        typedef typename decay<Ret>::type Result;
+        constexpr uint64_t moved = moveOnly<Args...>();
+        if ((flags & moved) != moved) {
+            return;
+        }
+        if constexpr (is_void<Ret>::value) {
+            (object->*method)(parameter<Args>(argument(Indexes), flags & (uint64_t(1) << Indexes))...);
+        } else if (flags & ConstructReturn) {
+            new (ret) Result((object->*method)(parameter<Args>(argument(Indexes), flags & (uint64_t(1) << Indexes))...));
+        } else if (ret) {
+            *static_cast<Result*>(ret) = (object->*method)(parameter<Args>(argument(Indexes), flags & (uint64_t(1) << Indexes))...);
+        } else {
+            (object->*method)(parameter<Args>(argument(Indexes), flags & (uint64_t(1) << Indexes))...);
+        }
+    }
+};
 
 } // namespace metainvoker
 //////////////////////////////////////////////////////////////////////////////////////
+/// The description of a reflected method. A literal type, so the methods of a class
+/// can be declared in a constexpr table, see METATABLE_BEGIN.
 ///
-///
-class MetaObject;
-class MetaMethodBase
+class MetaMethodRecord
 {
 public:
+    constexpr MetaMethodRecord(const MetaSymbol &symbol, const arguments::ArgContainer &arguments,
+                               uint64_t signatureHash, const void *target, metainvoker::Caller caller,
+                               metainvoker::Invoker invoker)
+        : m_name(symbol.name())
+        , m_symbol(symbol.id())
+        , m_signatureHash(signatureHash)
+        , m_arguments(arguments)
+        , m_target(target)
+        , m_caller(caller)
+        , m_invoker(invoker)
+    {
+    }
 
-    virtual ~MetaMethodBase() {}
-    explicit MetaMethodBase(const string &name)
-        : m_name(name)
+    // the record of the method pointed by target, called through the thunks shared by the
+    // methods of the signature
+    template <typename TReturnType, typename... Arguments>
+    static constexpr MetaMethodRecord create(const MetaSymbol &symbol,
+                                             const typename metainvoker::Call<TReturnType, Arguments...>::Method *target)
+    {
+        return create<TReturnType, Arguments...>(symbol, target, &metainvoker::Call<TReturnType, Arguments...>::caller,
+                                                 &metainvoker::Call<TReturnType, Arguments...>::invoker);
+    }
+
+    // the same called through the given thunks, see metainvoker::Call::Thunks
+    template <typename TReturnType, typename... Arguments>
+    static constexpr MetaMethodRecord create(const MetaSymbol &symbol,
+                                             const typename metainvoker::Call<TReturnType, Arguments...>::Method *target,
+                                             metainvoker::Caller caller, metainvoker::Invoker invoker)
     {
+        return MetaMethodRecord(symbol, arguments::signature<TReturnType, Arguments...>(),
+                                arguments::signatureHash<TReturnType, Arguments...>(), target, caller, invoker);
     }
 
-    string name() const
+    constexpr string_view name() const
     {
         return m_name;
     }
 
+    constexpr uint64_t symbol() const
+    {
+        return m_symbol;
+    }
+
+    // the symbols are hashes, two names may share one; the symbols made from an id alone
+    // match by the id
+    bool isNamed(MetaSymbol name) const
+    {
+        return m_symbol == name.id() && (name.name().empty() || m_name.empty() || m_name == name.name());
+    }
+
     arguments::ArgIterator argumentsBegin() const
     {
-        return ++m_arguments.begin();
+        return m_arguments.begin() + 1;
     }
     arguments::ArgIterator argumentsEnd() const
     {
@@ -75,15 +267,38 @@ public:
         return m_arguments.size() - 1;
     }
 
-    bool isReturnType(const arguments::ArgumentType &retType)
+    // hash of the return and argument types, see arguments::signatureHash()
+    uint64_t signatureHash() const
+    {
+        return m_signatureHash;
+    }
+
+    const arguments::ArgumentType &returnType() const
+    {
+        return m_arguments[0];
+    }
+
+    bool isReturnType(const arguments::ArgumentType &retType) const
     {
         return (m_arguments[0] == retType);
     }
 
-    bool compatibleArguments(const arguments::ArgContainer &invokeArgs)
+    // the signature hashes may collide, the types tell whether the signature is the same
+    bool isSignature(const arguments::ArgumentType &retType, const arguments::ArgContainer &argTypes) const
+    {
+        return isReturnType(retType) && equal(argumentsBegin(), argumentsEnd(), argTypes.begin(), argTypes.end());
+    }
+
+    // methods with the same return and argument types override each other
+    bool isSameSignature(const MetaMethodRecord &that) const
+    {
+        return m_arguments == that.m_arguments;
+    }
+
+    bool compatibleArguments(const arguments::ArgContainer &invokeArgs) const
     {
         if (m_arguments.size() - 1 == invokeArgs.size()) {
-            arguments::ArgIterator argsThis = ++m_arguments.cbegin();
+            arguments::ArgIterator argsThis = m_arguments.cbegin() + 1;
             arguments::ArgIterator argsThat = invokeArgs.cbegin();
             bool ok = true;
             while (ok && (argsThis != m_arguments.cend()) && (argsThat != invokeArgs.cend())) {
@@ -97,7 +312,7 @@ public:
     }
 
     template <class Class, typename Func, typename Tuple>
-    inline bool apply(Class && c, Func && f, Tuple && t)
+    inline bool apply(Class && c, Func && f, Tuple && t) const
     {
         if (traits::function_traits<typename decay<Func>::type>::arity == m_arguments.size() - 1) {
             tuple_invoke::apply(forward<Class>(c), forward<Func>(f), forward<Tuple>(t));
@@ -106,11 +321,67 @@ public:
         return false;
     }
 
-    virtual bool invoke(MetaObject *object, ReturnArgumentBase ret, vector<ArgumentBase> &args) = 0;
+    // typed call, the argument types must be compatible with the ones of the method; the
+    // arguments are forwarded, the rvalues are moved into the by-value parameters. ret is
+    // either null or points to a value of the return type.
+    template <typename... Arguments>
+    inline void call(MetaObject *object, void *ret, Arguments &&...args) const
+    {
+        void *argv[] = { const_cast<void*>(static_cast<const void*>(addressof(args)))..., nullptr };
+        metastats::Sample sample(this);
+        m_caller(m_target, object, ret, argv, metainvoker::movable<Arguments...>());
+    }
+
+    // args points to the argument values, see metainvoker::Caller for the flags
+    void callPacked(MetaObject *object, void *ret, void **args, uint64_t flags = 0) const
+    {
+        metastats::Sample sample(this);
+        m_caller(m_target, object, ret, args, flags);
+    }
+
+    // untyped call, the return value is written to ret unless ret is not valid; false if
+    // the types of the arguments or of the return value do not match the method
+    bool invoke(MetaObject *object, const ReturnArgumentBase &ret, span<const ArgumentBase> args) const
+    {
+        if (args.size() != size_t(argumentCount()) || (ret.isValid() && !isReturnType(ret.type()))) {
+            return false;
+        }
+        for (size_t i = 0; i < args.size(); ++i) {
+            if (!argumentsBegin()[i].isCompatible(args[i].type())) {
+                return false;
+            }
+        }
+        metastats::Sample sample(this);
+        m_invoker(m_target, object, ret.isValid() ? const_cast<void*>(ret.data()) : nullptr, args);
+        return true;
+    }
 
 protected:
-    string m_name;
+    string_view m_name;
+    uint64_t m_symbol;
+    uint64_t m_signatureHash;
     arguments::ArgContainer m_arguments;
+    const void *m_target;
+    metainvoker::Caller m_caller;
+    metainvoker::Invoker m_invoker;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// The methods registered at runtime, owned by their MetaClass.
+///
+class MetaMethodBase : public MetaMethodRecord
+{
+public:
+    explicit MetaMethodBase(const MetaMethodRecord &record)
+        : MetaMethodRecord(record)
+        , m_nameStorage(record.name())
+    {
+        m_name = m_nameStorage;
+    }
+    virtual ~MetaMethodBase() {}
+
+private:
+    string m_nameStorage;
 };
 
 //////////////////////////////////////////////////////////////////////////////////////
@@ -120,25 +391,25 @@ template <class TObject, typename TReturnType, typename... Arguments>
 class MetaMethod : public MetaMethodBase
 {
     TReturnType (TObject::*m_method)(Arguments...);
-    metainvoker::Invoker m_invoker = nullptr;
+    // the target of the record
+    typename metainvoker::Call<TReturnType, Arguments...>::Method m_target;
 public:
 
-    explicit MetaMethod(TReturnType (TObject::*method)(Arguments...), metainvoker::Invoker invoker, const string &name)
-        : MetaMethodBase(name)
-        , m_invoker(invoker)
+    explicit MetaMethod(TReturnType (TObject::*method)(Arguments...), const MetaSymbol &name)
+        : MetaMethodBase(MetaMethodRecord::create<TReturnType, Arguments...>(name, &m_target))
         , m_method(method)
+        , m_target(static_cast<decltype(m_target)>(method))
     {
-        m_arguments = arguments::argumentTypes(method);
     }
+    MetaMethod(const MetaMethod&) = delete;
+    MetaMethod &operator=(const MetaMethod&) = delete;
     virtual ~MetaMethod() {}
 
-    inline TReturnType invoke(TObject *object, Arguments... args)
+    using MetaMethodRecord::invoke;
+    template<typename... Values>
+    inline TReturnType invoke(TObject *object, Values &&...args)
     {
-        if (std::is_same<TReturnType, void>::value) {
-            (object->*m_method)(args...);
-        } else {
-            return (object->*m_method)(args...);
-        }
+        return (object->*m_method)(forward<Values>(args)...);
     }
 
     template<typename Tuple>
@@ -150,238 +421,1500 @@ public:
             return tuple_invoke::apply(m_method, object, forward<Tuple>(t));
         }
     }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// View over the constexpr method table of a class, sorted by the symbols of the methods
+/// at compile time, see METATABLE_BEGIN.
+///
+class MetaMethodTable
+{
+    const MetaMethodRecord *const *m_records = nullptr;
+    size_t m_size = 0;
+
+public:
+    typedef const MetaMethodRecord *const *Iterator;
+    typedef pair<Iterator, Iterator> Range;
+
+    constexpr MetaMethodTable() = default;
+    template <size_t N>
+    constexpr MetaMethodTable(const array<const MetaMethodRecord*, N> &records)
+        : m_records(records.data())
+        , m_size(N)
+    {
+    }
 
-    bool invoke(MetaObject *object, ReturnArgumentBase ret, vector<ArgumentBase> &args) override
+    constexpr Iterator begin() const
     {
-        if (args.size() != argumentCount()) {
-            return false;
+        return m_records;
+    }
+    constexpr Iterator end() const
+    {
+        return m_records + m_size;
+    }
+    constexpr size_t size() const
+    {
+        return m_size;
+    }
+
+    // the overloads registered under the symbol, found with binary search
+    Range find(uint64_t symbol) const
+    {
+        return equal_range(begin(), end(), symbol, Compare());
+    }
+
+private:
+    struct Compare
+    {
+        bool operator()(const MetaMethodRecord *record, uint64_t symbol) const
+        {
+            return record->symbol() < symbol;
         }
-        // check if the return type is similar to what we need
-        if (ret.isValid() && !isReturnType(ret.type())) {
-            return false;
+        bool operator()(uint64_t symbol, const MetaMethodRecord *record) const
+        {
+            return symbol < record->symbol();
         }
+    };
+};
 
-        // invoke the method
-        if (m_invoker) {
-            m_invoker(object, ret, args);
-        }
+namespace metatable
+{
 
-        return true;
+template <size_t N, size_t... Indexes>
+constexpr array<const MetaMethodRecord*, N> pointers(const MetaMethodRecord (&records)[N], index_sequence<Indexes...>)
+{
+    return {{ &records[Indexes]... }};
+}
+
+// the records sorted by their symbols; the overloads keep their declaration order
+template <size_t N>
+constexpr array<const MetaMethodRecord*, N> sorted(const MetaMethodRecord (&records)[N])
+{
+    array<const MetaMethodRecord*, N> result = pointers(records, make_index_sequence<N>());
+    for (size_t i = 1; i < N; ++i) {
+        for (size_t j = i; j > 0 && result[j]->symbol() < result[j - 1]->symbol(); --j) {
+            const MetaMethodRecord *record = result[j];
+            result[j] = result[j - 1];
+            result[j - 1] = record;
+        }
     }
-};
+    return result;
+}
+
+} // namespace metatable
 
 //////////////////////////////////////////////////////////////////////////////////////
+/// Compile time lookup of the methods declared with META_METHOD, see MetaClass::invokeStatic().
+/// The META_METHOD sequence of a class is evaluated as a constant expression, visiting the
+/// member pointer of each method.
 ///
-///
-class MetaObject;
-class MetaClass
+namespace metastatic
 {
-    typedef multimap<string, MetaMethodBase*> MetaMethodContainer;
-    const MetaClass *m_superClass = nullptr;
-    MetaMethodContainer m_methods;
 
-public:
-    explicit MetaClass(const MetaClass *super = nullptr)
-        : m_superClass(super)
-    {
-    }
-    ~MetaClass()
+// a method name given as a template argument
+template<size_t N>
+struct Name
+{
+    char text[N] = {};
+
+    constexpr Name(const char (&name)[N])
     {
-        for (auto mm : m_methods) {
-            delete mm.second;
-        }
+        copy_n(name, N, text);
     }
-    void addMetaMethod(MetaMethodBase *method)
+    constexpr string_view view() const
     {
-        m_methods.insert(pair<string, MetaMethodBase*>(method->name(), method));
+        return string_view(text, N - 1);
     }
+};
 
-    typedef MetaMethodContainer::const_iterator MetaMethodIterator;
-    typedef pair<MetaMethodIterator, MetaMethodIterator> MetaMethodRange;
-    static MetaMethodRange methodRange(MetaObject *object, const string &name);
+// the qualifiers of a parameter
+enum : unsigned { Const = 1, LValue = 2, RValue = 4 };
 
-    const MetaClass *superClass() const
+template<typename T>
+constexpr unsigned qualifiers()
+{
+    return (is_const<typename remove_reference<T>::type>::value ? unsigned(Const) : 0u)
+           | (is_lvalue_reference<T>::value ? unsigned(LValue) : 0u)
+           | (is_rvalue_reference<T>::value ? unsigned(RValue) : 0u);
+}
+
+template<typename T, unsigned Qualifiers>
+struct Qualified
+{
+    typedef typename conditional<Qualifiers & Const, const T, T>::type Value;
+    typedef typename conditional<Qualifiers & RValue, Value&&,
+                                 typename conditional<Qualifiers & LValue, Value&, Value>::type>::type type;
+};
+
+// visits nothing, the META_METHOD sequence registers or calls the methods
+struct NoQuery
+{
+    template<typename TMethod>
+    constexpr void visit(int, string_view, TMethod)
     {
-        return m_superClass;
     }
+};
 
-    template<typename TReturnType, typename... Arguments>
-    static bool invoke(MetaObject *o, const string &signature, Arguments... args);
-    template<typename TReturnType, typename... Arguments>
-    static bool invoke(MetaObject *o, TReturnType &ret, const string &signature, Arguments... args);
-
-    static bool invoke(MetaObject *object, const string &name,
-                       ReturnArgumentBase ret = ReturnArgumentBase(),
-                       vector<ArgumentBase> args = vector<ArgumentBase>());
+// finds the first method of the name returning TReturnType, which takes the arguments as they
+// are, with no conversion; the lvalues bind to the const and the lvalue references only, as
+// in a direct call
+template<typename TReturnType, typename... Arguments>
+struct Lookup
+{
+    string_view name;
+    int index = -1;
+    unsigned parameters[sizeof... (Arguments) + 1] = {};
 
-    template<class TObject, typename Tuple>
-    static bool apply(TObject *object, const string &name, Tuple&& arguments)
+    template<class TClass, typename TMethodReturn, typename... Parameters>
+    constexpr void visit(int counter, string_view methodName, TMethodReturn (TClass::*)(Parameters...))
     {
-        const MetaClass *mo = object->metaClass();
-        MetaMethodRange range = mo->m_methods.equal_range(name);
-        if (range.first == range.second) {
-            return false;
-        }
-        for (MetaMethodIterator i = range.first; i != range.second; ++i) {
-            size_t argCount = tuple_size<typename decay<Tuple>::type>::value;
-            if (i->second->argumentCount() == argCount) {
-//                tuple_invoke::apply(object, i->second->m_method, forward<Tuple>(arguments));
-                return true;
+        if constexpr (is_same<TMethodReturn, TReturnType>::value && sizeof... (Parameters) == sizeof... (Arguments)) {
+            if constexpr ((is_same<typename remove_cvref<Parameters>::type, typename remove_cvref<Arguments>::type>::value && ...)
+                          && is_invocable<void (*)(Parameters...), Arguments&&...>::value) {
+                if (index < 0 && methodName == name) {
+                    index = counter;
+                    unsigned i = 0;
+                    ((parameters[i++] = qualifiers<Parameters>()), ...);
+                }
             }
         }
-        return false;
     }
+};
 
-    template<typename TReturnType>
-    MetaMethodBase *getMethod(const string &name, const arguments::ArgContainer &argTypes) const
+// fetches the member pointer of the method found by Lookup
+template<typename TMethod>
+struct Fetch
+{
+    int index = -1;
+    TMethod method = nullptr;
+
+    template<typename TOther>
+    constexpr void visit(int counter, string_view, TOther candidate)
     {
-        arguments::ArgumentType returnType = arguments::ArgumentType::value<TReturnType>();
-        for (auto mm : m_methods) {
-            if ((mm.first == name) &&
-                mm.second->isReturnType(returnType) &&
-                mm.second->compatibleArguments(argTypes)) {
-                return mm.second;
+        if constexpr (is_same<TOther, TMethod>::value) {
+            if (counter == index) {
+                method = candidate;
             }
         }
-        return nullptr;
     }
 };
 
-#if defined(__clang__)
-    #define WARNING_PUSH                _Pragma("clang diagnostic push")
-    #define DISABLE_OVERRIDE_WARNING    _Pragma("clang diagnostic ignored \"-Winconsistent-missing-override\"")
-    #define WARNING_POP                 _Pragma("clang diagnostic pop")
-#else
-    #define WARNING_PUSH
-    #define DISABLE_OVERRIDE_WARNING
-    #define WARNING_POP
-#endif
-
-#define METACLASS_BEGIN(Class, SuperClass) \
-    public: \
-    static const MetaClass staticMetaObject; \
-    WARNING_PUSH \
-    DISABLE_OVERRIDE_WARNING \
-    virtual const MetaClass *metaObject() const { return &staticMetaObject; } \
-    virtual void initMetaClass(Class *thisClass) \
-    { \
-        typedef class Class TClass; \
-        SuperClass::initMetaClass(static_cast<SuperClass*>(thisClass)); \
-        MetaClass *mo = const_cast<MetaClass*>(thisClass->metaObject()); \
-        (void)(mo);
-
-#define METACLASS_END() \
-    } \
-    WARNING_POP
-
-#define METAOBJECT(Class, SuperClass) \
-const MetaClass Class::staticMetaObject { &SuperClass::staticMetaObject };
+// the member pointer of the method Name of TClass, looked up from TClass towards its super
+// classes; found is false if none of them declares it
+template<class TClass, Name MethodName, typename TReturnType, typename... Arguments>
+struct Method
+{
+    typedef typename TClass::MetaThisClass Class;
+    typedef typename Class::MetaSuperClass SuperClass;
 
-#define META_METHOD(Method, ReturnType, ...) \
-    mo->addMetaMethod(new MetaMethod<TClass, ReturnType, ##__VA_ARGS__>( \
-        &TClass::Method, \
-        &metainvoker::invoker<TClass, ReturnType, ##__VA_ARGS__, &TClass::Method>, \
-        #Method));
+    static constexpr Lookup<TReturnType, Arguments...> lookup = []() {
+        Lookup<TReturnType, Arguments...> lookup { MethodName.view() };
+        Class::metaMethods(nullptr, nullptr, -1, nullptr, 0, &lookup);
+        return lookup;
+    }();
 
-//////////////////////////////////////////////////////////////////////////////////////
-///
-///
-class MetaObject
-{
-public:
-    // metadata section for the default class
-    static const MetaClass staticMetaObject;
-    virtual const MetaClass *metaObject() const { return &staticMetaObject; }
-    virtual void initMetaClass(MetaObject *)
+    template<size_t... Indexes>
+    static consteval auto fetch(index_sequence<Indexes...>)
     {
-        typedef class MetaObject TClass;
-        MetaClass *mo = const_cast<MetaClass*>(metaObject());
-        META_METHOD(abstractMethod, int, const vector<int>&)
+        typedef TReturnType (Class::*Pointer)(typename Qualified<typename remove_cvref<Arguments>::type, lookup.parameters[Indexes]>::type...);
+        Fetch<Pointer> fetch { lookup.index };
+        Class::metaMethods(nullptr, nullptr, -1, nullptr, 0, &fetch);
+        return fetch.method;
     }
 
-public:
-    explicit MetaObject() {}
-    virtual ~MetaObject() {}
+    static consteval auto resolve()
+    {
+        if constexpr (lookup.index >= 0) {
+            return fetch(index_sequence_for<Arguments...>());
+        } else if constexpr (!is_same<Class, SuperClass>::value) {
+            return Method<SuperClass, MethodName, TReturnType, Arguments...>::resolve();
+        } else {
+            return nullptr;
+        }
+    }
 
-    virtual int abstractMethod(const vector<int> &) = 0;
+    static constexpr auto pointer = resolve();
+    static constexpr bool found = !is_null_pointer<decltype(pointer)>::value;
 };
-const MetaClass MetaObject::staticMetaObject;
+
+} // namespace metastatic
 
 //////////////////////////////////////////////////////////////////////////////////////
+/// The result of MetaClass::invokeAsync(). The call runs on MetaThreadPool::instance()
+/// with the state it shares with the future: the arguments, moved in place when they fit
+/// its buffer, and the result, constructed in place. The state is a block of
+/// MetaBlockAllocator, released by the last of the future and the worker, so the future
+/// can be moved; it waits for the call when destroyed.
 ///
-///
-MetaClass::MetaMethodRange MetaClass::methodRange(MetaObject *object, const string &name)
+template<typename TReturnType>
+class MetaFuture
 {
-    return object->metaObject()->m_methods.equal_range(name);
-}
+    friend class MetaClass;
+    static constexpr size_t BufferSize = 64;
+    typedef typename conditional<is_void<TReturnType>::value, char, TReturnType>::type Result;
 
-template<typename TReturnType, typename... Arguments>
-bool MetaClass::invoke(MetaObject *o, const string &signature, Arguments... args)
-{
-    arguments::ArgContainer argTypes = arguments::argumentTypes(forward<Arguments>(args)...);
-    MetaClass *mo = const_cast<MetaClass*>(o->metaObject());
-    while (mo) {
-        MetaMethodBase *method = mo->getMethod<TReturnType>(signature, argTypes);
-        if (method) {
-            MetaMethod<MetaObject, TReturnType, Arguments...> *mCasted =
-                    static_cast<MetaMethod<MetaObject, TReturnType, Arguments...>*>(method);
-            if (mCasted) {
-                mCasted->invoke(o, args...);
-                return true;
+    struct State
+    {
+        const MetaMethodRecord *method = nullptr;
+        MetaObject *object = nullptr;
+        // the arguments, in buffer or on the heap
+        void *arguments = nullptr;
+        alignas(max_align_t) unsigned char buffer[BufferSize];
+        alignas(Result) unsigned char result[sizeof(Result)];
+        bool hasResult = false;
+        atomic<bool> ready = false;
+        // the future and the worker
+        atomic<int> references = 2;
+        mutex lock;
+        condition_variable finished;
+
+        ~State()
+        {
+            if (hasResult) {
+                reinterpret_cast<Result*>(result)->~Result();
             }
         }
-        // check superclass
-        mo = const_cast<MetaClass*>(mo->superClass());
-    }
-    return false;
-}
 
-template<typename TReturnType, typename... Arguments>
-bool MetaClass::invoke(MetaObject *o, TReturnType &ret, const string &signature, Arguments... args)
-{
-    arguments::ArgContainer argTypes = arguments::argumentTypes(forward<Arguments>(args)...);
-    MetaClass *mo = const_cast<MetaClass*>(o->metaObject());
-    while (mo) {
-        MetaMethodBase *method = o->metaObject()->getMethod<TReturnType>(signature, argTypes);
-        if (method) {
-            MetaMethod<MetaObject, TReturnType, Arguments...> *mCasted =
-                    static_cast<MetaMethod<MetaObject, TReturnType, Arguments...>*>(method);
-            if (mCasted) {
-                if (is_void<TReturnType>::value) {
-                    mCasted->invoke(o, args...);
-                } else {
-                    ret = mCasted->invoke(o, args...);
-                }
-                return true;
+        void release()
+        {
+            if (references.fetch_sub(1, memory_order_acq_rel) == 1) {
+                this->~State();
+                MetaBlockAllocator::deallocate(this, sizeof(State));
             }
         }
-        // continue in superclass
-        mo = const_cast<MetaClass*>(mo->superClass());
+    };
+    State *m_state = nullptr;
+
+    template<typename Tuple, size_t... Indexes>
+    static void call(State *state, Tuple &arguments, index_sequence<Indexes...>)
+    {
+        (void)(arguments);
+        // the arguments are moved into the by-value parameters
+        void *argv[] = { static_cast<void*>(addressof(std::get<Indexes>(arguments)))..., nullptr };
+        const uint64_t flags = metainvoker::movable<typename tuple_element<Indexes, Tuple>::type...>();
+        if constexpr (is_void<TReturnType>::value) {
+            state->method->callPacked(state->object, nullptr, argv, flags);
+        } else {
+            state->method->callPacked(state->object, state->result, argv, flags | metainvoker::ConstructReturn);
+            state->hasResult = true;
+        }
     }
-    return false;
-}
 
-bool MetaClass::invoke(MetaObject *object, const string &name,
-                   ReturnArgumentBase ret, vector<ArgumentBase> args)
-{
-    if (args.size() > MAX_ARGS) {
-        return false;
+    template<typename Tuple>
+    static void run(void *context)
+    {
+        State *state = static_cast<State*>(context);
+        Tuple *arguments = static_cast<Tuple*>(state->arguments);
+        call(state, *arguments, make_index_sequence<tuple_size<Tuple>::value>());
+        if (state->arguments == state->buffer) {
+            arguments->~Tuple();
+        } else {
+            delete arguments;
+        }
+        {
+            lock_guard<mutex> lock(state->lock);
+            state->ready.store(true, memory_order_release);
+            state->finished.notify_all();
+        }
+        state->release();
     }
-    MetaClass *mo = const_cast<MetaClass*>(object->metaObject());
-    while (mo) {
-        MetaMethodRange range = mo->methodRange(object, name);
-        for (MetaMethodIterator i = range.first; i != range.second; ++i) {
-            if (args.size() == i->second->argumentCount()) {
-                // call the invoker
-                if (i->second->invoke(object, ret, args)) {
-                    return true;
-                }
-            }
+
+    template<typename... Arguments>
+    MetaFuture(const MetaMethodRecord *method, MetaObject *object, Arguments &&...args)
+        : m_state(new (MetaBlockAllocator::allocate(sizeof(State))) State)
+    {
+        typedef tuple<typename decay<Arguments>::type...> Tuple;
+        m_state->method = method;
+        m_state->object = object;
+        if (sizeof(Tuple) <= BufferSize && alignof(Tuple) <= alignof(max_align_t)) {
+            m_state->arguments = new (m_state->buffer) Tuple(forward<Arguments>(args)...);
+        } else {
+            m_state->arguments = new Tuple(forward<Arguments>(args)...);
         }
-        // continue in superclass
-        mo = const_cast<MetaClass*>(mo->superClass());
+        MetaThreadPool::instance().post(MetaThreadPool::Task { &run<Tuple>, m_state });
     }
-    return false;
+
+public:
+    // an unresolved call, ready at once
+    MetaFuture() = default;
+    MetaFuture(const MetaFuture &) = delete;
+    MetaFuture &operator =(const MetaFuture &) = delete;
+    MetaFuture(MetaFuture &&that)
+        : m_state(exchange(that.m_state, nullptr))
+    {
+    }
+    MetaFuture &operator =(MetaFuture &&that)
+    {
+        if (this != &that) {
+            reset();
+            m_state = exchange(that.m_state, nullptr);
+        }
+        return *this;
+    }
+    ~MetaFuture()
+    {
+        reset();
+    }
+
+    // false if no method was found for the call, or the future was moved from
+    bool isValid() const
+    {
+        return m_state != nullptr;
+    }
+
+    bool isReady() const
+    {
+        return !m_state || m_state->ready.load(memory_order_acquire);
+    }
+
+    void wait()
+    {
+        if (!isReady()) {
+            unique_lock<mutex> lock(m_state->lock);
+            m_state->finished.wait(lock, [this]() { return isReady(); });
+        }
+    }
+
+    // what get() returns, an optional for the return types which cannot be default constructed
+    typedef typename conditional<is_void<TReturnType>::value || is_default_constructible<TReturnType>::value,
+                                 TReturnType, optional<TReturnType>>::type Value;
+
+    // waits for the call and moves its result out; a value initialized result, or an empty
+    // optional, for the unresolved calls and the futures moved from
+    Value get()
+    {
+        wait();
+        if constexpr (!is_void<TReturnType>::value) {
+            if (!m_state || !m_state->hasResult) {
+                return Value();
+            }
+            return Value(move(*reinterpret_cast<Result*>(m_state->result)));
+        }
+    }
+
+private:
+    // waits for the call and releases the state
+    void reset()
+    {
+        if (m_state) {
+            wait();
+            exchange(m_state, nullptr)->release();
+        }
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+///
+///
+class MetaObject;
+class MetaScheduler;
+class MetaImage;
+template<typename TReturnType, typename... Arguments>
+class MetaCall;
+class MetaClass
+{
+    friend class MetaImage;
+
+public:
+    // registers the methods of the class
+    typedef void (*Initializer)(MetaClass *);
+    // calls the method of the index among the ones declared with META_METHOD in the class,
+    // see invokeByIndex()
+    typedef void (*Metacall)(MetaObject *object, int index, void **args, uint64_t flags);
+
+private:
+    // overloads are stored in the order of registration under the symbol of their name
+    typedef vector<const MetaMethodRecord*> MetaMethodList;
+    typedef MetaSymbolTable<MetaMethodList> MetaMethodContainer;
+    const MetaClass *m_superClass = nullptr;
+    Initializer m_initializer = nullptr;
+    // the name of the class, identifies the class in a MetaImage
+    const char *m_name = nullptr;
+    // the methods declared at compile time, and the ones registered at runtime; the overloads
+    // of a symbol in both are merged in m_methods
+    MetaMethodTable m_table;
+    MetaMethodContainer m_methods;
+    vector<unique_ptr<MetaMethodBase>> m_ownedMethods;
+    // the methods declared with META_METHOD in the order of their indexes, which start after
+    // the ones of the super class
+    Metacall m_metacall = nullptr;
+    vector<const MetaMethodRecord*> m_indexed;
+    int m_methodOffset = 0;
+    mutable once_flag m_initializeOnce;
+
+    // the lookup tables read by the invocations; immutable once published, a registration
+    // publishes new ones and retires the old ones, see MetaEpoch
+    struct Snapshot
+    {
+        // the methods of this class
+        MetaMethodContainer declared;
+        // the methods of this class merged with the inherited ones
+        MetaMethodContainer dispatch;
+        // when set, the methods are looked up in the image instead of the containers
+        const MetaImage *image = nullptr;
+        uint32_t imageClass = 0;
+    };
+    mutable atomic<const Snapshot*> m_snapshot = nullptr;
+    static inline atomic<size_t> s_generation = 1;
+    // serializes the registrations and the publishing of the snapshots
+    static inline mutex s_registryLock;
+    // the classes with a published snapshot, the super classes before the derived ones
+    static inline vector<const MetaClass*> s_classes;
+
+    // the memoized overload resolutions, keyed by the name and the signature of the invoke;
+    // failed resolutions are kept too. A set associative cache, allocated once per class:
+    // the entries are updated in place under a seqlock, the readers copy an entry and retry
+    // when a writer changed it meanwhile, so neither a miss nor a collision allocates or
+    // locks. The entries made before a method or a conversion was added are stale.
+    struct ResolutionEntry
+    {
+        // odd while a writer updates the entry
+        atomic<uint32_t> sequence = 0;
+        atomic<bool> used = false;
+        // the invoke resolved; the argument types are compared by address, the signature
+        // arrays are static
+        atomic<uint64_t> symbol = 0;
+        atomic<uint64_t> signatureHash = 0;
+        atomic<uint32_t> returnType = 0;
+        atomic<const arguments::ArgumentType*> argTypes = nullptr;
+        atomic<size_t> argCount = 0;
+        atomic<size_t> generation = 0;
+        atomic<size_t> conversionGeneration = 0;
+        atomic<const MetaMethodRecord*> method = nullptr;
+        // the method takes the arguments converted as planned
+        atomic<bool> converted = false;
+        atomic<MetaConversion::Converter> converters[MetaConversion::MaxArguments] = {};
+        atomic<int> types[MetaConversion::MaxArguments] = {};
+    };
+    static constexpr size_t ResolutionSets = 8;
+    static constexpr size_t ResolutionWays = 4;
+    struct ResolutionSet
+    {
+        ResolutionEntry ways[ResolutionWays];
+        // the way replaced when none is free or stale
+        atomic<uint32_t> victim = 0;
+    };
+    mutable atomic<ResolutionSet*> m_resolutions = nullptr;
+
+    // the methods are registered once per class, on the first reflective use of the class
+    void initialize() const
+    {
+        call_once(m_initializeOnce, [this]() {
+            if (m_superClass) {
+                m_superClass->snapshot();
+                const_cast<MetaClass*>(this)->m_methodOffset = m_superClass->m_methodOffset + int(m_superClass->m_indexed.size());
+            }
+            if (m_initializer) {
+                m_initializer(const_cast<MetaClass*>(this));
+            }
+            lock_guard<mutex> lock(s_registryLock);
+            if (!publishImage()) {
+                publish();
+            }
+            s_classes.push_back(this);
+        });
+    }
+
+    // the snapshot is only valid while the calling thread is inside a MetaEpoch::Guard
+    const Snapshot *snapshot() const
+    {
+        const Snapshot *snapshot = m_snapshot.load(memory_order_seq_cst);
+        if (!snapshot) {
+            initialize();
+            snapshot = m_snapshot.load(memory_order_seq_cst);
+        }
+        return snapshot;
+    }
+
+    // builds and publishes the snapshot of the class, with the registry lock held
+    void publish() const
+    {
+        Snapshot *snapshot = new Snapshot;
+        snapshot->declared = m_methods;
+        for (MetaMethodTable::Iterator i = m_table.begin(); i != m_table.end(); ++i) {
+            if (!m_methods.find((*i)->symbol())) {
+                snapshot->declared[(*i)->symbol()].push_back(*i);
+            }
+        }
+        snapshot->dispatch = snapshot->declared;
+        if (m_superClass) {
+            const Snapshot *super = m_superClass->m_snapshot.load(memory_order_relaxed);
+            m_superClass->forEachMethods(super, false, [snapshot](uint64_t symbol, MetaMethodRange inherited) {
+                MetaMethodList &list = snapshot->dispatch[symbol];
+                const size_t ownCount = list.size();
+                for (const MetaMethodRecord *method : span(inherited.first, inherited.second)) {
+                    auto overridden = find_if(list.cbegin(), list.cbegin() + ownCount, [method](const MetaMethodRecord *own) {
+                        return own->isSameSignature(*method);
+                    });
+                    if (overridden == list.cbegin() + ownCount) {
+                        list.push_back(method);
+                    }
+                }
+            });
+        }
+        replaceSnapshot(snapshot);
+    }
+
+    void replaceSnapshot(const Snapshot *snapshot) const
+    {
+        const Snapshot *old = m_snapshot.exchange(snapshot, memory_order_seq_cst);
+        if (old) {
+            MetaEpoch::retire(old);
+        }
+    }
+
+    // the class declaring the method of the index, null if the index is out of range
+    const MetaClass *indexOwner(int index) const
+    {
+        snapshot();
+        if (index < 0) {
+            return nullptr;
+        }
+        const MetaClass *metaClass = this;
+        while (index < metaClass->m_methodOffset) {
+            metaClass = metaClass->m_superClass;
+        }
+        return size_t(index - metaClass->m_methodOffset) < metaClass->m_indexed.size() ? metaClass : nullptr;
+    }
+
+    // publishes the snapshot looking the methods up in the installed MetaImage, if the class
+    // is in it and all its methods are declared in its table; with the registry lock held
+    bool publishImage() const;
+
+    // calls f(symbol, range) with the overloads of each symbol of the snapshot, either the
+    // dispatched or the declared ones
+    template<typename Function>
+    void forEachMethods(const Snapshot *snapshot, bool declared, Function f) const;
+
+public:
+    explicit MetaClass(const MetaClass *super = nullptr, Initializer initializer = nullptr, const char *name = nullptr,
+                       Metacall metacall = nullptr)
+        : m_superClass(super)
+        , m_initializer(initializer)
+        , m_name(name)
+        , m_metacall(metacall)
+    {
+    }
+    explicit MetaClass(const MetaClass *super, const MetaMethodTable &table, const char *name = nullptr)
+        : m_superClass(super)
+        , m_name(name)
+        , m_table(table)
+    {
+    }
+    ~MetaClass()
+    {
+        delete m_snapshot.load(memory_order_relaxed);
+        delete[] m_resolutions.load(memory_order_relaxed);
+    }
+
+    // takes the ownership of the method; registrations are serialized, they can run
+    // concurrently with the invocations
+    void addMetaMethod(MetaMethodBase *method)
+    {
+        lock_guard<mutex> lock(s_registryLock);
+        m_ownedMethods.emplace_back(method);
+        MetaMethodList &list = m_methods[method->symbol()];
+        if (list.empty()) {
+            MetaMethodTable::Range declared = m_table.find(method->symbol());
+            list.assign(declared.first, declared.second);
+        }
+        list.push_back(method);
+        if (m_snapshot.load(memory_order_relaxed)) {
+            for (const MetaClass *metaClass : s_classes) {
+                if (metaClass->inherits(this)) {
+                    metaClass->publish();
+                }
+            }
+        }
+        s_generation.fetch_add(1, memory_order_release);
+    }
+
+    // registers the method under the next index of the class, see META_METHOD
+    void addIndexedMethod(MetaMethodBase *method)
+    {
+        m_indexed.push_back(method);
+        addMetaMethod(method);
+    }
+
+    // the index of the first method declared in the class; the indexes of the inherited
+    // methods are below it
+    int methodOffset() const
+    {
+        snapshot();
+        return m_methodOffset;
+    }
+
+    // the number of indexed methods of the class, the inherited ones included
+    int methodCount() const
+    {
+        snapshot();
+        return m_methodOffset + int(m_indexed.size());
+    }
+
+    // the method of the index, null if the index is out of range
+    const MetaMethodRecord *method(int index) const
+    {
+        const MetaClass *metaClass = indexOwner(index);
+        return metaClass ? metaClass->m_indexed[index - metaClass->m_methodOffset] : nullptr;
+    }
+
+    // the index of the method with the name and the exact signature, see arguments::signatureHash(),
+    // looked up from this class towards the super classes; -1 if there is none
+    int indexOfMethod(MetaSymbol name, uint64_t signatureHash) const
+    {
+        snapshot();
+        for (const MetaClass *metaClass = this; metaClass; metaClass = metaClass->m_superClass) {
+            for (size_t i = metaClass->m_indexed.size(); i-- > 0;) {
+                const MetaMethodRecord *method = metaClass->m_indexed[i];
+                if (method->isNamed(name) && method->signatureHash() == signatureHash) {
+                    return metaClass->m_methodOffset + int(i);
+                }
+            }
+        }
+        return -1;
+    }
+    template<typename TReturnType, typename... Arguments>
+    int indexOfMethod(MetaSymbol name) const
+    {
+        return indexOfMethod(name, arguments::signatureHash<TReturnType, Arguments...>());
+    }
+
+    // calls the method of the index through the metacall of the class declaring it, with no
+    // name lookup. args[0] points to the return value or is null, args[1] and on to the
+    // arguments, which must have the types of the signature the index was looked up with;
+    // the flags are the ones of metainvoker::Caller. False if the index is out of range.
+    static bool invokeByIndex(MetaObject *object, int index, void **args, uint64_t flags = 0);
+
+    // changes each time a method is registered in any of the classes
+    static size_t generation()
+    {
+        return s_generation.load(memory_order_acquire);
+    }
+
+    // true if the class is the given one, or is derived from it
+    bool inherits(const MetaClass *metaClass) const
+    {
+        for (const MetaClass *c = this; c; c = c->m_superClass) {
+            if (c == metaClass) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    typedef MetaMethodTable::Iterator MetaMethodIterator;
+    typedef MetaMethodTable::Range MetaMethodRange;
+    // the ranges stay valid while the calling thread holds a MetaEpoch::Guard; the methods
+    // themselves live as long as their MetaClass
+    static MetaMethodRange methodRange(MetaObject *object, MetaSymbol name);
+
+    // the overloads callable on this class under the given name, the own methods first,
+    // followed by the inherited ones which are not overridden
+    MetaMethodRange methods(MetaSymbol name) const;
+
+    // the overloads registered in this class under the given name
+    MetaMethodRange declaredMethods(MetaSymbol name) const;
+
+    const MetaClass *superClass() const
+    {
+        return m_superClass;
+    }
+
+    // null for the classes declared without a name
+    const char *name() const
+    {
+        return m_name;
+    }
+
+    // true if the methods of the class are looked up in a MetaImage
+    bool isImageBacked() const
+    {
+        MetaEpoch::Guard guard;
+        return snapshot()->image != nullptr;
+    }
+
+    // the classes initialized so far, the super classes before the derived ones
+    static vector<const MetaClass*> classes()
+    {
+        lock_guard<mutex> lock(s_registryLock);
+        return s_classes;
+    }
+
+    // the calls of the methods declared in this class, and the invocations on this class
+    // which found no method, summed up over the threads; empty unless built with
+    // METAMETHOD_STATS
+    MetaStats stats() const
+    {
+        MetaStats stats;
+#if defined(METAMETHOD_STATS)
+        unordered_map<const void*, size_t> indexes;
+        {
+            MetaEpoch::Guard guard;
+            forEachMethods(snapshot(), true, [&stats, &indexes](uint64_t, MetaMethodRange list) {
+                for (const MetaMethodRecord *method : span(list.first, list.second)) {
+                    indexes[method] = stats.methods.size();
+                    MetaStats::Method entry;
+                    entry.name = method->name();
+                    entry.signatureHash = method->signatureHash();
+                    stats.methods.push_back(move(entry));
+                }
+            });
+        }
+        metastats::collect([&](const void *key, uint64_t symbol, const string &name, const metastats::Counters &counters) {
+            if (symbol) {
+                if (key != this) {
+                    return;
+                }
+                auto miss = find_if(stats.misses.begin(), stats.misses.end(), [&name](const MetaStats::Miss &miss) {
+                    return miss.name == name;
+                });
+                if (miss == stats.misses.end()) {
+                    miss = stats.misses.insert(miss, MetaStats::Miss { name, 0 });
+                }
+                miss->count += counters.calls.load(memory_order_relaxed);
+            } else if (auto index = indexes.find(key); index != indexes.end()) {
+                MetaStats::Method &entry = stats.methods[index->second];
+                entry.calls += counters.calls.load(memory_order_relaxed);
+                for (size_t i = 0; i < MetaStats::Buckets; ++i) {
+                    entry.latency[i] += counters.latency[i].load(memory_order_relaxed);
+                }
+                entry.latencySum += counters.latencySum.load(memory_order_relaxed);
+            }
+        });
+#endif
+        return stats;
+    }
+
+private:
+    template<typename TReturnType, typename TResults, typename... Arguments>
+    static size_t invokeRange(span<MetaObject *const> objects, size_t begin, size_t end, TResults results,
+                              MetaSymbol name, Arguments &...args);
+
+    static MetaMethodRange range(const MetaMethodList *list)
+    {
+        if (!list) {
+            return MetaMethodRange(nullptr, nullptr);
+        }
+        return MetaMethodRange(list->data(), list->data() + list->size());
+    }
+
+public:
+
+    // typed invokes; the arguments are forwarded, so the lvalues bind to the reference
+    // parameters without copies, and the rvalues, move-only ones included, are moved into
+    // the by-value parameters
+    template<typename TReturnType, typename... Arguments>
+    static bool invoke(MetaObject *o, MetaSymbol signature, Arguments &&...args);
+    template<typename TReturnType, typename... Arguments>
+    static bool invoke(MetaObject *o, TReturnType &ret, MetaSymbol signature, Arguments &&...args);
+
+    // invokes the method taking the arguments pointed by args; the return value is written
+    // to the storage of ret
+    static bool invoke(MetaObject *object, MetaSymbol name,
+                       const ReturnArgumentBase &ret = ReturnArgumentBase(),
+                       span<const ArgumentBase> args = span<const ArgumentBase>());
+    static bool invoke(MetaObject *object, MetaSymbol name, const ReturnArgumentBase &ret, initializer_list<ArgumentBase> args)
+    {
+        return invoke(object, name, ret, span<const ArgumentBase>(args.begin(), args.size()));
+    }
+    // invokes the method taking arguments of the types held by args; the arguments are passed
+    // as lvalues, so the methods taking non-const references modify them. The return value
+    // replaces the content of ret, which is emptied for void methods.
+    static bool invoke(MetaObject *object, MetaSymbol name, MetaValue &ret, span<MetaValue> args = span<MetaValue>());
+
+    // calls the method declared with META_METHOD in the static type of the object or in its
+    // super classes, resolved at compile time into a direct call of the member function; a
+    // call matching no method does not compile. The methods reached only through the runtime
+    // lookup, the ones added at runtime or overridden in table classes, need invoke().
+    template<typename TReturnType, metastatic::Name MethodName, class TObject, typename... Arguments>
+    static TReturnType invokeStatic(TObject *object, Arguments &&...args);
+
+    // resolves the method on the calling thread, and calls it on MetaThreadPool::instance()
+    // with the arguments moved into the returned future
+    template<typename TReturnType, typename... Arguments>
+    static MetaFuture<TReturnType> invokeAsync(MetaObject *o, MetaSymbol name, Arguments... args);
+
+#if defined(__cpp_impl_coroutine)
+    // awaitable call, see MetaCall; the method is resolved on the calling thread, the call
+    // is made as the scheduler decides
+    template<typename TReturnType, typename... Arguments>
+    static MetaCall<TReturnType, Arguments...> call(MetaObject *o, MetaSymbol name, Arguments... args);
+    template<typename TReturnType, typename... Arguments>
+    static MetaCall<TReturnType, Arguments...> call(MetaScheduler &scheduler, MetaObject *o, MetaSymbol name, Arguments... args);
+#endif
+
+    // invokes the method on each of the objects, resolving it once per distinct class; the
+    // result of objects[i] is written to results[i], if results has that many elements.
+    // Returns the number of objects the method was invoked on. The arguments are passed to
+    // every call as lvalues, so each call copies the ones taken by value.
+    template<typename TReturnType, typename... Arguments> requires (!is_void<TReturnType>::value)
+    static size_t invokeBatch(span<MetaObject *const> objects, span<TReturnType> results,
+                              MetaSymbol name, Arguments... args);
+    // the same, dropping the results
+    template<typename TReturnType, typename... Arguments>
+    static size_t invokeBatch(span<MetaObject *const> objects, MetaSymbol name, Arguments... args);
+    // same as invokeBatch(), with the batch split across MetaThreadPool::instance(); the
+    // arguments are shared by the threads, so they must not be passed by non-const reference
+    template<typename TReturnType, typename... Arguments> requires (!is_void<TReturnType>::value)
+    static size_t invokeBatchParallel(span<MetaObject *const> objects, span<TReturnType> results,
+                                      MetaSymbol name, Arguments... args);
+    template<typename TReturnType, typename... Arguments>
+    static size_t invokeBatchParallel(span<MetaObject *const> objects, MetaSymbol name, Arguments... args);
+
+    template<class TObject, typename Tuple>
+    static bool apply(TObject *object, MetaSymbol name, Tuple&& arguments)
+    {
+        MetaEpoch::Guard guard;
+        const MetaClass *mo = object->metaClass();
+        MetaMethodRange range = mo->methods(name);
+        if (range.first == range.second) {
+            return false;
+        }
+        for (MetaMethodIterator i = range.first; i != range.second; ++i) {
+            size_t argCount = tuple_size<typename decay<Tuple>::type>::value;
+            if ((*i)->argumentCount() == argCount) {
+//                tuple_invoke::apply(object, i->second->m_method, forward<Tuple>(arguments));
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template<typename TReturnType>
+    const MetaMethodRecord *getMethod(MetaSymbol name, const arguments::ArgContainer &argTypes) const
+    {
+        constexpr uint64_t returnTypeHash = arguments::typeHash<TReturnType>();
+        return getMethod<TReturnType>(name, argTypes, arguments::combineHash(returnTypeHash, argTypes.hash()));
+    }
+
+    // resolves the method with an exact signature match first, then falls back to the methods
+    // which are compatible with the arguments; the resolutions are memoized in the class
+    template<typename TReturnType>
+    const MetaMethodRecord *getMethod(MetaSymbol name, const arguments::ArgContainer &argTypes, uint64_t signatureHash) const
+    {
+        MetaEpoch::Guard guard;
+        bool converted = false;
+        const MetaMethodRecord *method = resolve(name, arguments::ArgumentType::value<TReturnType>(), argTypes, signatureHash,
+                                                 converted, nullptr);
+        return converted ? nullptr : method;
+    }
+
+    // resolves the cheapest overload callable with the arguments converted, see MetaConversion,
+    // when getMethod() resolves none; the conversions to make are written to plan
+    template<typename TReturnType>
+    const MetaMethodRecord *getConvertedMethod(MetaSymbol name, const arguments::ArgContainer &argTypes, uint64_t signatureHash,
+                                               MetaConversion::Plan &plan) const
+    {
+        MetaEpoch::Guard guard;
+        bool converted = false;
+        const MetaMethodRecord *method = resolve(name, arguments::ArgumentType::value<TReturnType>(), argTypes, signatureHash,
+                                                 converted, &plan);
+        return converted ? method : nullptr;
+    }
+
+    // calls the method with the arguments converted as planned; the converted values and
+    // the rvalue arguments are moved into the by-value parameters
+    template<typename... Arguments>
+    static void callConverted(const MetaMethodRecord *method, const MetaConversion::Plan &plan, MetaObject *object,
+                              void *ret, Arguments &&...args)
+    {
+        void *argv[] = { const_cast<void*>(static_cast<const void*>(addressof(args)))..., nullptr };
+        MetaValue converted[sizeof... (Arguments) + 1];
+        const uint64_t flags = convertArguments(plan, argv, converted, sizeof... (Arguments));
+        method->callPacked(object, ret, argv, flags | metainvoker::movable<Arguments...>());
+    }
+
+private:
+    // the resolution of the invoke, memoized; the plan is written when the method takes the
+    // arguments converted
+    const MetaMethodRecord *resolve(MetaSymbol name, const arguments::ArgumentType &returnType, const arguments::ArgContainer &argTypes,
+                                    uint64_t signatureHash, bool &converted, MetaConversion::Plan *plan) const
+    {
+        const uint64_t key = arguments::combineHash(name.id(), signatureHash);
+        const size_t generation = MetaClass::generation();
+        const size_t conversionGeneration = MetaConversion::generation();
+        ResolutionSet &set = resolutionSets()[(key ^ (key >> 32)) % ResolutionSets];
+        // the way to replace, a free or a stale one first
+        size_t replaced = ResolutionWays;
+        for (size_t way = 0; way < ResolutionWays; ++way) {
+            const ResolutionEntry &entry = set.ways[way];
+            const uint32_t sequence = entry.sequence.load(memory_order_acquire);
+            if (sequence & 1) {
+                continue;
+            }
+            if (!entry.used.load(memory_order_relaxed) || entry.generation.load(memory_order_relaxed) != generation
+                || entry.conversionGeneration.load(memory_order_relaxed) != conversionGeneration) {
+                if (replaced == ResolutionWays) {
+                    replaced = way;
+                }
+                continue;
+            }
+            if (entry.symbol.load(memory_order_relaxed) != name.id() || entry.signatureHash.load(memory_order_relaxed) != signatureHash
+                || entry.returnType.load(memory_order_relaxed) != returnType.m_value
+                || entry.argTypes.load(memory_order_relaxed) != argTypes.begin()
+                || entry.argCount.load(memory_order_relaxed) != argTypes.size()) {
+                continue;
+            }
+            const MetaMethodRecord *method = entry.method.load(memory_order_relaxed);
+            converted = entry.converted.load(memory_order_relaxed);
+            if (converted && plan) {
+                for (size_t i = 0; i < argTypes.size(); ++i) {
+                    plan->converters[i] = entry.converters[i].load(memory_order_relaxed);
+                    plan->types[i] = entry.types[i].load(memory_order_relaxed);
+                }
+            }
+            atomic_thread_fence(memory_order_acquire);
+            if (entry.sequence.load(memory_order_relaxed) == sequence) {
+                return method;
+            }
+        }
+
+        MetaConversion::Plan resolved;
+        converted = false;
+        const MetaMethodRecord *method = findMethod(name, returnType, argTypes, signatureHash);
+        if (!method) {
+            unsigned cost = MetaConversion::None;
+            MetaMethodRange range = methods(name);
+            for (MetaMethodIterator i = range.first; i != range.second; ++i) {
+                if (!(*i)->isNamed(name) || !(*i)->isReturnType(returnType) || size_t((*i)->argumentCount()) != argTypes.size()) {
+                    continue;
+                }
+                MetaConversion::Plan candidate;
+                const unsigned candidateCost = MetaConversion::plan((*i)->argumentsBegin(), argTypes.begin(), argTypes.size(), candidate);
+                if (candidateCost < cost) {
+                    cost = candidateCost;
+                    method = *i;
+                    converted = true;
+                    resolved = candidate;
+                }
+            }
+        }
+        if (converted && plan) {
+            *plan = resolved;
+        }
+
+        if (replaced == ResolutionWays) {
+            replaced = set.victim.fetch_add(1, memory_order_relaxed) % ResolutionWays;
+        }
+        ResolutionEntry &entry = set.ways[replaced];
+        uint32_t sequence = entry.sequence.load(memory_order_relaxed);
+        // with another thread updating the entry, the resolution is not memoized
+        if ((sequence & 1) || !entry.sequence.compare_exchange_strong(sequence, sequence + 1, memory_order_relaxed)) {
+            return method;
+        }
+        atomic_thread_fence(memory_order_release);
+        entry.used.store(true, memory_order_relaxed);
+        entry.symbol.store(name.id(), memory_order_relaxed);
+        entry.signatureHash.store(signatureHash, memory_order_relaxed);
+        entry.returnType.store(returnType.m_value, memory_order_relaxed);
+        entry.argTypes.store(argTypes.begin(), memory_order_relaxed);
+        entry.argCount.store(argTypes.size(), memory_order_relaxed);
+        entry.generation.store(generation, memory_order_relaxed);
+        entry.conversionGeneration.store(conversionGeneration, memory_order_relaxed);
+        entry.method.store(method, memory_order_relaxed);
+        entry.converted.store(converted, memory_order_relaxed);
+        for (size_t i = 0; converted && i < argTypes.size(); ++i) {
+            entry.converters[i].store(resolved.converters[i], memory_order_relaxed);
+            entry.types[i].store(resolved.types[i], memory_order_relaxed);
+        }
+        entry.sequence.store(sequence + 2, memory_order_release);
+        return method;
+    }
+
+    // the memoized resolutions, allocated on the first resolution in the class
+    ResolutionSet *resolutionSets() const
+    {
+        ResolutionSet *sets = m_resolutions.load(memory_order_acquire);
+        if (!sets) {
+            ResolutionSet *created = new ResolutionSet[ResolutionSets];
+            if (m_resolutions.compare_exchange_strong(sets, created, memory_order_acq_rel)) {
+                sets = created;
+            } else {
+                delete[] created;
+            }
+        }
+        return sets;
+    }
+
+    // the overload matching the signature, or compatible with the arguments
+    const MetaMethodRecord *findMethod(MetaSymbol name, const arguments::ArgumentType &returnType, const arguments::ArgContainer &argTypes,
+                                       uint64_t signatureHash) const
+    {
+        MetaMethodRange range = methods(name);
+        for (MetaMethodIterator i = range.first; i != range.second; ++i) {
+            if ((*i)->signatureHash() == signatureHash && (*i)->isNamed(name) && (*i)->isSignature(returnType, argTypes)) {
+                return *i;
+            }
+        }
+        for (MetaMethodIterator i = range.first; i != range.second; ++i) {
+            if ((*i)->isNamed(name) && (*i)->isReturnType(returnType) && (*i)->compatibleArguments(argTypes)) {
+                return *i;
+            }
+        }
+        return nullptr;
+    }
+
+    // the dynamic invoke of the methods reached by converting the arguments
+    static bool invokeConverted(MetaSymbol name, MetaMethodRange range, MetaObject *object, MetaValue &ret, span<MetaValue> args);
+    // calls the method, replacing ret with the return value
+    static bool callPacked(const MetaMethodRecord *method, MetaObject *object, MetaValue &ret, void **argv, uint64_t flags = 0);
+
+    // replaces the arguments to convert with their converted values, held by converted
+    // returns the Caller flags of the converted arguments, which can be moved from
+    static uint64_t convertArguments(const MetaConversion::Plan &plan, void **argv, MetaValue *converted, size_t count)
+    {
+        uint64_t flags = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (MetaConversion::Converter convert = plan.converters[i]) {
+                const void *from = argv[i];
+                converted[i].construct(plan.types[i], [convert, from](void *to) { convert(to, from); });
+                argv[i] = converted[i].data();
+                flags |= uint64_t(1) << i;
+            }
+        }
+        return flags;
+    }
+};
+
+#if defined(__clang__)
+    #define WARNING_PUSH                _Pragma("clang diagnostic push")
+    #define DISABLE_OVERRIDE_WARNING    _Pragma("clang diagnostic ignored \"-Winconsistent-missing-override\"")
+    #define WARNING_POP                 _Pragma("clang diagnostic pop")
+#else
+    #define WARNING_PUSH
+    #define DISABLE_OVERRIDE_WARNING
+    #define WARNING_POP
+#endif
+
+// The META_METHOD sequence expands into a single function: called with a MetaClass it
+// registers the methods, called with an object it is the switch of staticMetacall(), one
+// case per method index, calling the member function directly, and evaluated as a constant
+// expression with a query it visits the member pointers, see metastatic. The indexes follow
+// the order of the META_METHOD lines, counted with __COUNTER__.
+#define METACLASS_BEGIN(Class, SuperClass) \
+    public: \
+    static const MetaClass staticMetaObject; \
+    WARNING_PUSH \
+    DISABLE_OVERRIDE_WARNING \
+    virtual const MetaClass *metaObject() const { return &staticMetaObject; } \
+    static void initMetaClass(MetaClass *mo) \
+    { \
+        metaMethods(mo, nullptr, -1, nullptr, 0); \
+    } \
+    static void staticMetacall(MetaObject *object, int index, void **args, uint64_t flags) \
+    { \
+        metaMethods(nullptr, object, index, args, flags); \
+    } \
+    typedef class Class MetaThisClass; \
+    typedef SuperClass MetaSuperClass; \
+    static constexpr int metaMethodCounter = __COUNTER__; \
+    template<typename Query = metastatic::NoQuery> \
+    static constexpr void metaMethods(MetaClass *mo, MetaObject *object, int index, void **args, uint64_t flags, \
+                                      Query *query = nullptr) \
+    { \
+        typedef class Class TClass; \
+        (void)(object); \
+        (void)(args); \
+        (void)(flags); \
+        switch (index) { \
+        default: \
+            if (!mo && !query) { \
+                return; \
+            }
+
+#define METACLASS_END() \
+        } \
+    } \
+    WARNING_POP
+
+#define METAOBJECT(Class, SuperClass) \
+const MetaClass Class::staticMetaObject { &SuperClass::staticMetaObject, &Class::initMetaClass, #Class, &Class::staticMetacall };
+
+#define META_METHOD(Method, ReturnType, ...) \
+    META_METHOD_INDEXED(__COUNTER__, Method, ReturnType, ##__VA_ARGS__)
+
+// adds a method with no index to the MetaClass mo at runtime, outside METACLASS_BEGIN
+#define META_ADD_METHOD(Method, ReturnType, ...) \
+    mo->addMetaMethod(new MetaMethodBase(META_METHOD_RECORD(META_SYMBOL(#Method), Method, ReturnType, ##__VA_ARGS__)));
+
+// the record of TClass::Method, called through its metainvoker::Call::Thunks
+#define META_METHOD_RECORD(Symbol, Method, ReturnType, ...) \
+    MetaMethodRecord::create<ReturnType, ##__VA_ARGS__>( \
+        Symbol, \
+        &metainvoker::Call<ReturnType, ##__VA_ARGS__>::template method<TClass, &TClass::Method>, \
+        metainvoker::Call<ReturnType, ##__VA_ARGS__>::template Thunks<TClass, &TClass::Method>::caller, \
+        metainvoker::Call<ReturnType, ##__VA_ARGS__>::template Thunks<TClass, &TClass::Method>::invoker)
+
+#define META_METHOD_INDEXED(Counter, Method, ReturnType, ...) \
+            if (query) { \
+                query->visit(Counter - TClass::metaMethodCounter - 1, #Method, \
+                             static_cast<ReturnType (TClass::*)(__VA_ARGS__)>(&TClass::Method)); \
+            } else { \
+                mo->addIndexedMethod(new MetaMethodBase(META_METHOD_RECORD(META_SYMBOL(#Method), Method, ReturnType, ##__VA_ARGS__))); \
+            } \
+            if (false) { \
+        case Counter - TClass::metaMethodCounter - 1: \
+                metainvoker::Call<ReturnType, ##__VA_ARGS__>::template direct<TClass, &TClass::Method>(object, args[0], args + 1, flags); \
+                return; \
+            }
+
+// Alternative to METACLASS_BEGIN: the methods are declared in a constexpr table, sorted at
+// compile time, so they cost no registration work at runtime. Methods can still be added
+// to the MetaClass of the class with addMetaMethod().
+#define METATABLE_BEGIN(Class, SuperClass) \
+    public: \
+    static const MetaClass staticMetaObject; \
+    WARNING_PUSH \
+    DISABLE_OVERRIDE_WARNING \
+    virtual const MetaClass *metaObject() const { return &staticMetaObject; } \
+    static MetaMethodTable metaMethodTable() \
+    { \
+        typedef class Class TClass; \
+        static constexpr MetaMethodRecord records[] = {
+
+#define METATABLE_END() \
+        }; \
+        static constexpr auto table = metatable::sorted(records); \
+        return MetaMethodTable(table); \
+    } \
+    WARNING_POP
+
+#define METATABLE_OBJECT(Class, SuperClass) \
+const MetaClass Class::staticMetaObject { &SuperClass::staticMetaObject, Class::metaMethodTable(), #Class };
+
+#define META_RECORD(Method, ReturnType, ...) \
+            META_METHOD_RECORD(MetaSymbol(#Method), Method, ReturnType, ##__VA_ARGS__),
+
+//////////////////////////////////////////////////////////////////////////////////////
+///
+///
+class MetaObject
+{
+    // metadata section for the default class
+    METACLASS_BEGIN(MetaObject, MetaObject)
+        META_METHOD(abstractMethod, int, const vector<int>&)
+    METACLASS_END()
+
+public:
+    explicit MetaObject() {}
+    virtual ~MetaObject() {}
+
+    virtual int abstractMethod(const vector<int> &) = 0;
+};
+const MetaClass MetaObject::staticMetaObject { nullptr, &MetaObject::initMetaClass, "MetaObject", &MetaObject::staticMetacall };
+
+//////////////////////////////////////////////////////////////////////////////////////
+///
+///
+MetaClass::MetaMethodRange MetaClass::methodRange(MetaObject *object, MetaSymbol name)
+{
+    return object->metaObject()->methods(name);
+}
+
+bool MetaClass::invokeByIndex(MetaObject *object, int index, void **args, uint64_t flags)
+{
+    const MetaClass *metaClass = object->metaObject()->indexOwner(index);
+    if (!metaClass || !metaClass->m_metacall) {
+        return false;
+    }
+    const int localIndex = index - metaClass->m_methodOffset;
+    metastats::Sample sample(metaClass->m_indexed[localIndex]);
+    metaClass->m_metacall(object, localIndex, args, flags);
+    return true;
+}
+
+template<typename TReturnType, typename... Arguments>
+bool MetaClass::invoke(MetaObject *o, MetaSymbol signature, Arguments &&...args)
+{
+    constexpr arguments::ArgContainer argTypes = arguments::signature<typename metainvoker::Forwarded<Arguments>::type...>();
+    constexpr uint64_t signatureHash = arguments::signatureHash<TReturnType, typename metainvoker::Forwarded<Arguments>::type...>();
+    const MetaMethodRecord *method = o->metaObject()->getMethod<TReturnType>(signature, argTypes, signatureHash);
+    if (method) {
+        method->call(o, nullptr, metainvoker::forwardArgument<Arguments>(args)...);
+        return true;
+    }
+    MetaConversion::Plan plan;
+    method = o->metaObject()->getConvertedMethod<TReturnType>(signature, argTypes, signatureHash, plan);
+    if (method) {
+        callConverted(method, plan, o, nullptr, metainvoker::forwardArgument<Arguments>(args)...);
+        return true;
+    }
+    metastats::recordMiss(o->metaObject(), signature);
+    return false;
+}
+
+template<typename TReturnType, typename... Arguments>
+bool MetaClass::invoke(MetaObject *o, TReturnType &ret, MetaSymbol signature, Arguments &&...args)
+{
+    constexpr arguments::ArgContainer argTypes = arguments::signature<typename metainvoker::Forwarded<Arguments>::type...>();
+    constexpr uint64_t signatureHash = arguments::signatureHash<TReturnType, typename metainvoker::Forwarded<Arguments>::type...>();
+    const MetaMethodRecord *method = o->metaObject()->getMethod<TReturnType>(signature, argTypes, signatureHash);
+    if (method) {
+        method->call(o, &ret, metainvoker::forwardArgument<Arguments>(args)...);
+        return true;
+    }
+    MetaConversion::Plan plan;
+    method = o->metaObject()->getConvertedMethod<TReturnType>(signature, argTypes, signatureHash, plan);
+    if (method) {
+        callConverted(method, plan, o, &ret, metainvoker::forwardArgument<Arguments>(args)...);
+        return true;
+    }
+    metastats::recordMiss(o->metaObject(), signature);
+    return false;
+}
+
+template<typename TReturnType, metastatic::Name MethodName, class TObject, typename... Arguments>
+TReturnType MetaClass::invokeStatic(TObject *object, Arguments &&...args)
+{
+    typedef metastatic::Method<TObject, MethodName, TReturnType, typename metainvoker::Forwarded<Arguments>::type...> Method;
+    static_assert(Method::found, "no method of the name takes the arguments");
+    return (object->*Method::pointer)(metainvoker::forwardArgument<Arguments>(args)...);
+}
+
+template<typename TReturnType, typename... Arguments>
+MetaFuture<TReturnType> MetaClass::invokeAsync(MetaObject *o, MetaSymbol name, Arguments... args)
+{
+    constexpr arguments::ArgContainer argTypes = arguments::signature<Arguments...>();
+    constexpr uint64_t signatureHash = arguments::signatureHash<TReturnType, Arguments...>();
+    const MetaMethodRecord *method = o->metaObject()->getMethod<TReturnType>(name, argTypes, signatureHash);
+    if (!method) {
+        metastats::recordMiss(o->metaObject(), name);
+        return MetaFuture<TReturnType>();
+    }
+    return MetaFuture<TReturnType>(method, o, move(args)...);
+}
+
+// results is a span of the results, or nullptr_t when they are dropped
+template<typename TReturnType, typename TResults, typename... Arguments>
+size_t MetaClass::invokeRange(span<MetaObject *const> objects, size_t begin, size_t end, TResults results,
+                              MetaSymbol name, Arguments &...args)
+{
+    constexpr arguments::ArgContainer argTypes = arguments::signature<Arguments...>();
+    constexpr uint64_t signatureHash = arguments::signatureHash<TReturnType, Arguments...>();
+    // the resolutions of the last distinct classes, the oldest one is replaced when full
+    constexpr size_t CacheSize = 8;
+    const MetaClass *classes[CacheSize] = {};
+    const MetaMethodRecord *resolved[CacheSize] = {};
+    size_t replaced = 0;
+
+    const MetaClass *lastClass = nullptr;
+    const MetaMethodRecord *method = nullptr;
+    size_t invoked = 0;
+    for (size_t i = begin; i < end; ++i) {
+        MetaObject *o = objects[i];
+        const MetaClass *metaClass = o->metaObject();
+        if (metaClass != lastClass) {
+            lastClass = metaClass;
+            const MetaClass **cached = find(classes, classes + CacheSize, metaClass);
+            if (cached != classes + CacheSize) {
+                method = resolved[cached - classes];
+            } else {
+                method = metaClass->getMethod<TReturnType>(name, argTypes, signatureHash);
+                classes[replaced] = metaClass;
+                resolved[replaced] = method;
+                replaced = (replaced + 1) % CacheSize;
+            }
+        }
+        if (method) {
+            if constexpr (is_same<TResults, nullptr_t>::value) {
+                method->call(o, nullptr, args...);
+            } else {
+                method->call(o, i < results.size() ? &results[i] : nullptr, args...);
+            }
+            ++invoked;
+        } else {
+            metastats::recordMiss(metaClass, name);
+        }
+    }
+    return invoked;
+}
+
+template<typename TReturnType, typename... Arguments> requires (!is_void<TReturnType>::value)
+size_t MetaClass::invokeBatch(span<MetaObject *const> objects, span<TReturnType> results,
+                              MetaSymbol name, Arguments... args)
+{
+    return invokeRange<TReturnType>(objects, 0, objects.size(), results, name, args...);
+}
+
+template<typename TReturnType, typename... Arguments>
+size_t MetaClass::invokeBatch(span<MetaObject *const> objects, MetaSymbol name, Arguments... args)
+{
+    return invokeRange<TReturnType>(objects, 0, objects.size(), nullptr, name, args...);
+}
+
+template<typename TReturnType, typename... Arguments> requires (!is_void<TReturnType>::value)
+size_t MetaClass::invokeBatchParallel(span<MetaObject *const> objects, span<TReturnType> results,
+                                      MetaSymbol name, Arguments... args)
+{
+    // below this the scheduling costs more than the calls
+    constexpr size_t Grain = 4096;
+    atomic<size_t> invoked = 0;
+    MetaThreadPool::instance().parallelFor(objects.size(), Grain, [&](size_t begin, size_t end) {
+        invoked += invokeRange<TReturnType>(objects, begin, end, results, name, args...);
+    });
+    return invoked.load();
+}
+
+template<typename TReturnType, typename... Arguments>
+size_t MetaClass::invokeBatchParallel(span<MetaObject *const> objects, MetaSymbol name, Arguments... args)
+{
+    constexpr size_t Grain = 4096;
+    atomic<size_t> invoked = 0;
+    MetaThreadPool::instance().parallelFor(objects.size(), Grain, [&](size_t begin, size_t end) {
+        invoked += invokeRange<TReturnType>(objects, begin, end, nullptr, name, args...);
+    });
+    return invoked.load();
+}
+
+bool MetaClass::invoke(MetaObject *object, MetaSymbol name,
+                       const ReturnArgumentBase &ret, span<const ArgumentBase> args)
+{
+    MetaEpoch::Guard guard;
+    MetaMethodRange range = object->metaObject()->methods(name);
+    for (MetaMethodIterator i = range.first; i != range.second; ++i) {
+        if ((*i)->isNamed(name) && (*i)->invoke(object, ret, args)) {
+            return true;
+        }
+    }
+    metastats::recordMiss(object->metaObject(), name);
+    return false;
+}
+
+bool MetaClass::invoke(MetaObject *object, MetaSymbol name, MetaValue &ret, span<MetaValue> args)
+{
+    MetaEpoch::Guard guard;
+    MetaMethodRange range = object->metaObject()->methods(name);
+    for (MetaMethodIterator i = range.first; i != range.second; ++i) {
+        if ((*i)->isNamed(name) && size_t((*i)->argumentCount()) == args.size() &&
+            equal(args.begin(), args.end(), (*i)->argumentsBegin(), [](const MetaValue &arg, const arguments::ArgumentType &type) {
+                // the values are copied into the by-value parameters
+                return arg.typeId() == type.typeId() && (type.isRef() || MetaType::info(type.typeId()).copy);
+            })) {
+            // the argument pointers are on the stack for the usual argument counts
+            constexpr size_t StackArguments = 8;
+            void *stack[StackArguments + 1];
+            unique_ptr<void*[]> heap(args.size() > StackArguments ? new void*[args.size() + 1] : nullptr);
+            void **argv = heap ? heap.get() : stack;
+            for (size_t a = 0; a < args.size(); ++a) {
+                argv[a] = args[a].data();
+            }
+            argv[args.size()] = nullptr;
+            return callPacked(*i, object, ret, argv);
+        }
+    }
+    // no overload takes the types as they are, try converting them
+    if (invokeConverted(name, range, object, ret, args)) {
+        return true;
+    }
+    metastats::recordMiss(object->metaObject(), name);
+    return false;
+}
+
+bool MetaClass::invokeConverted(MetaSymbol name, MetaMethodRange range, MetaObject *object, MetaValue &ret, span<MetaValue> args)
+{
+    if (args.size() > MetaConversion::MaxArguments) {
+        return false;
+    }
+    // the values are passed as lvalues
+    arguments::ArgumentType types[MetaConversion::MaxArguments];
+    for (size_t a = 0; a < args.size(); ++a) {
+        types[a] = arguments::ArgumentType(args[a].typeId(), false, true);
+    }
+    const MetaMethodRecord *method = nullptr;
+    MetaConversion::Plan plan;
+    unsigned cost = MetaConversion::None;
+    for (MetaMethodIterator i = range.first; i != range.second; ++i) {
+        MetaConversion::Plan candidate;
+        if ((*i)->isNamed(name) && size_t((*i)->argumentCount()) == args.size()) {
+            const unsigned candidateCost = MetaConversion::plan((*i)->argumentsBegin(), types, args.size(), candidate);
+            if (candidateCost < cost) {
+                method = *i;
+                plan = candidate;
+                cost = candidateCost;
+            }
+        }
+    }
+    if (!method) {
+        return false;
+    }
+    void *argv[MetaConversion::MaxArguments + 1] = {};
+    for (size_t a = 0; a < args.size(); ++a) {
+        argv[a] = args[a].data();
+    }
+    MetaValue converted[MetaConversion::MaxArguments];
+    const uint64_t flags = convertArguments(plan, argv, converted, args.size());
+    return callPacked(method, object, ret, argv, flags);
+}
+
+bool MetaClass::callPacked(const MetaMethodRecord *method, MetaObject *object, MetaValue &ret, void **argv, uint64_t flags)
+{
+    const int returnType = method->returnType().typeId();
+    if (returnType == MetaType::Undefined) {
+        ret.reset();
+        method->callPacked(object, nullptr, argv, flags);
+        return true;
+    }
+    if (ret.typeId() == returnType) {
+        // assigned, the arguments may refer to the current value
+        method->callPacked(object, ret.data(), argv, flags);
+        return true;
+    }
+    // constructed in place, so the return type needs no default constructor
+    return ret.construct(returnType, [method, object, argv, flags](void *storage) {
+        method->callPacked(object, storage, argv, flags | metainvoker::ConstructReturn);
+    });
+}
+
+#include "metacoroutine.h"
+#include "metaimage.h"
+
+MetaClass::MetaMethodRange MetaClass::methods(MetaSymbol name) const
+{
+    const Snapshot *snapshot = this->snapshot();
+    if (snapshot->image) {
+        return snapshot->image->methods(this, snapshot->imageClass, name.id(), false);
+    }
+    return range(snapshot->dispatch.find(name.id()));
+}
+
+MetaClass::MetaMethodRange MetaClass::declaredMethods(MetaSymbol name) const
+{
+    const Snapshot *snapshot = this->snapshot();
+    if (snapshot->image) {
+        return snapshot->image->methods(this, snapshot->imageClass, name.id(), true);
+    }
+    return range(snapshot->declared.find(name.id()));
+}
+
+bool MetaClass::publishImage() const
+{
+    const MetaImage *image = MetaImage::installed();
+    if (!image || !m_name || m_initializer || m_methods.size()) {
+        return false;
+    }
+    const uint32_t imageClass = image->findClass(m_name);
+    if (imageClass == MetaImage::NoClass || !image->matches(this, imageClass)) {
+        return false;
+    }
+    Snapshot *snapshot = new Snapshot;
+    snapshot->image = image;
+    snapshot->imageClass = imageClass;
+    replaceSnapshot(snapshot);
+    return true;
+}
+
+template<typename Function>
+void MetaClass::forEachMethods(const Snapshot *snapshot, bool declared, Function f) const
+{
+    if (snapshot->image) {
+        snapshot->image->forEachSymbol(snapshot->imageClass, [&](uint64_t symbol) {
+            f(symbol, snapshot->image->methods(this, snapshot->imageClass, symbol, declared));
+        });
+        return;
+    }
+    (declared ? snapshot->declared : snapshot->dispatch).forEach([&f](uint64_t symbol, const MetaMethodList &list) {
+        f(symbol, range(&list));
+    });
 }
 
 #endif // METACLASS_H
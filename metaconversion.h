@@ -0,0 +1,220 @@
+#ifndef METACONVERSION_H
+#define METACONVERSION_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "metatype.h"
+#include "metaepoch.h"
+#include "arguments.h"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// The implicit conversions of the arguments of the invokes. The conversions are kept in
+/// a dense matrix indexed by the source and the target type id, each cell holding the
+/// converter and the cost rank of the conversion. The matrix is built on first use with
+/// the conversions of the built-in types; more can be added with add(). The matrix is
+/// replaced when it grows, the readers never lock.
+///
+class MetaConversion
+{
+public:
+    // the cost ranks, the cheaper conversions are preferred by the overload resolution
+    enum Cost : uint8_t {
+        Exact = 0,
+        // integer widening, float to double
+        Promotion,
+        // integer to a floating point type holding all its values; the ones which may
+        // round, like int to float or long to double, are not made
+        Standard,
+        // conversions constructing a class, like const char* to string
+        UserDefined,
+        None = 0xff
+    };
+
+    // constructs the target value in the uninitialized to from the source value
+    typedef void (*Converter)(void *to, const void *from);
+
+    struct Cell
+    {
+        Converter convert = nullptr;
+        Cost cost = None;
+    };
+
+    // the arguments converted by a call
+    static constexpr size_t MaxArguments = 8;
+    struct Plan
+    {
+        // null for the arguments passed as they are
+        Converter converters[MaxArguments] = {};
+        int types[MaxArguments] = {};
+    };
+
+private:
+    struct Matrix
+    {
+        size_t dimension = 0;
+        vector<Cell> cells;
+
+        Cell &cell(size_t from, size_t to)
+        {
+            return cells[from * dimension + to];
+        }
+    };
+
+    static inline atomic<const Matrix*> s_matrix = nullptr;
+    static inline atomic<size_t> s_generation = 1;
+
+    static mutex &lock()
+    {
+        static mutex lock;
+        return lock;
+    }
+
+    template<typename From, typename To>
+    static void convert(void *to, const void *from)
+    {
+        new (to) To(*static_cast<const From*>(from));
+    }
+
+    // copies the matrix into one covering the types registered so far
+    static Matrix *grow(const Matrix *matrix, size_t dimension)
+    {
+        Matrix *grown = new Matrix;
+        grown->dimension = max(dimension, matrix ? matrix->dimension : 0);
+        grown->cells.resize(grown->dimension * grown->dimension);
+        for (size_t from = 0; matrix && from < matrix->dimension; ++from) {
+            copy_n(matrix->cells.begin() + from * matrix->dimension, matrix->dimension, grown->cells.begin() + from * grown->dimension);
+        }
+        return grown;
+    }
+
+    // with the lock held
+    static void publish(Matrix *matrix)
+    {
+        if (const Matrix *old = s_matrix.exchange(matrix, memory_order_acq_rel)) {
+            MetaEpoch::retire(old);
+        }
+    }
+
+    template<typename From, typename To>
+    static void set(Matrix &matrix, Cost cost)
+    {
+        matrix.cell(size_t(MetaType::typeId<From>()), size_t(MetaType::typeId<To>())) = Cell { &convert<From, To>, cost };
+    }
+
+    template<typename From, typename... To>
+    static void setAll(Matrix &matrix, Cost cost)
+    {
+        (set<From, To>(matrix, cost), ...);
+    }
+
+    static const Matrix &matrix()
+    {
+        static once_flag once;
+        call_once(once, []() {
+            const int charStar = MetaType::typeId<const char*>();
+            const int intSpan = MetaType::typeId<span<const int>>();
+            lock_guard<mutex> guard(lock());
+            Matrix *matrix = grow(s_matrix.load(memory_order_relaxed), size_t(max(charStar, intSpan)) + 1);
+
+            setAll<bool, int, long, long long>(*matrix, Promotion);
+            setAll<char, short, int, long, long long>(*matrix, Promotion);
+            setAll<unsigned char, unsigned short, unsigned int, unsigned long, unsigned long long, int, long, long long>(*matrix, Promotion);
+            setAll<short, int, long, long long>(*matrix, Promotion);
+            setAll<unsigned short, unsigned int, unsigned long, unsigned long long, int, long, long long>(*matrix, Promotion);
+            setAll<int, long, long long>(*matrix, Promotion);
+            setAll<unsigned int, unsigned long, unsigned long long, long, long long>(*matrix, Promotion);
+            set<long, long long>(*matrix, Promotion);
+            set<unsigned long, unsigned long long>(*matrix, Promotion);
+            set<float, double>(*matrix, Promotion);
+
+            setAll<short, float, double>(*matrix, Standard);
+            setAll<unsigned short, float, double>(*matrix, Standard);
+            set<int, double>(*matrix, Standard);
+            set<unsigned int, double>(*matrix, Standard);
+
+            set<const char*, string>(*matrix, UserDefined);
+            set<char*, string>(*matrix, UserDefined);
+            set<vector<int>, span<const int>>(*matrix, UserDefined);
+            publish(matrix);
+        });
+        return *s_matrix.load(memory_order_acquire);
+    }
+
+public:
+    // the conversion of a value of type from to a value of type to; the caller must hold a
+    // MetaEpoch::Guard
+    static Cell find(int from, int to)
+    {
+        if (from == to) {
+            return Cell { nullptr, Exact };
+        }
+        const Matrix &conversions = matrix();
+        if (size_t(from) >= conversions.dimension || size_t(to) >= conversions.dimension) {
+            return Cell();
+        }
+        return conversions.cells[size_t(from) * conversions.dimension + size_t(to)];
+    }
+
+    // adds or replaces the conversion from From to To, made by constructing To from From
+    template<typename From, typename To>
+    static void add(Cost cost = UserDefined)
+    {
+        add(MetaType::typeId<From>(), MetaType::typeId<To>(), &convert<From, To>, cost);
+    }
+
+    static void add(int from, int to, Converter convert, Cost cost)
+    {
+        matrix();
+        lock_guard<mutex> guard(lock());
+        Matrix *updated = grow(s_matrix.load(memory_order_relaxed), size_t(max(from, to)) + 1);
+        updated->cell(size_t(from), size_t(to)) = Cell { convert, cost };
+        publish(updated);
+        s_generation.fetch_add(1, memory_order_release);
+    }
+
+    // changes each time a conversion is added
+    static size_t generation()
+    {
+        return s_generation.load(memory_order_acquire);
+    }
+
+    // the total cost of passing the invoked argument types to the declared ones, None if
+    // an argument cannot be passed; the conversions to make are written to plan. The caller
+    // must hold a MetaEpoch::Guard.
+    static unsigned plan(arguments::ArgIterator declared, arguments::ArgIterator invoked, size_t count, Plan &plan)
+    {
+        if (count > MaxArguments) {
+            return None;
+        }
+        unsigned total = Exact;
+        for (size_t i = 0; i < count; ++i) {
+            plan.converters[i] = nullptr;
+            plan.types[i] = declared[i].typeId();
+            if (declared[i].isCompatible(invoked[i])) {
+                continue;
+            }
+            // the converted values are temporaries, they do not bind to non-const references
+            if (declared[i].typeId() == invoked[i].typeId() || (declared[i].isRef() && !declared[i].isConst())) {
+                return None;
+            }
+            const Cell cell = find(invoked[i].typeId(), declared[i].typeId());
+            if (cell.cost == None) {
+                return None;
+            }
+            plan.converters[i] = cell.convert;
+            total += cell.cost;
+        }
+        return total;
+    }
+};
+
+#endif // METACONVERSION_H
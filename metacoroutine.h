@@ -0,0 +1,221 @@
+#ifndef METACOROUTINE_H
+#define METACOROUTINE_H
+
+// included by metaclass.h; the awaitable calls need C++20 coroutines
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <tuple>
+
+#include "metaallocator.h"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Runs the calls awaited with MetaClass::call().
+///
+class MetaScheduler
+{
+public:
+    virtual ~MetaScheduler() {}
+
+    // runs the task calling the method and resuming the awaiting coroutine; returns false
+    // to have the call made inline, on the awaiting thread, without suspending
+    virtual bool schedule(const MetaMethodRecord &method, MetaThreadPool::Task task) = 0;
+
+    // the scheduler used when no scheduler is passed to MetaClass::call()
+    static MetaScheduler &defaultScheduler();
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Posts the calls to MetaThreadPool::instance(), except the calls of the methods marked
+/// as cheap, which are made inline.
+///
+class MetaPoolScheduler : public MetaScheduler
+{
+    MetaSymbolTable<bool> m_inline;
+
+public:
+    // not thread safe, meant to be called before the calls are made
+    void setInline(MetaSymbol name)
+    {
+        m_inline[name.id()] = true;
+    }
+
+    bool schedule(const MetaMethodRecord &method, MetaThreadPool::Task task) override
+    {
+        if (m_inline.find(method.symbol())) {
+            return false;
+        }
+        MetaThreadPool::instance().post(task);
+        return true;
+    }
+};
+
+inline MetaScheduler &MetaScheduler::defaultScheduler()
+{
+    static MetaPoolScheduler scheduler;
+    return scheduler;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Fire and forget coroutine, started at once and destroyed when it returns. The frames
+/// are allocated with MetaBlockAllocator.
+///
+class MetaTask
+{
+public:
+    struct promise_type
+    {
+        static void *operator new(size_t size)
+        {
+            return MetaBlockAllocator::allocate(size);
+        }
+        static void operator delete(void *p, size_t size)
+        {
+            MetaBlockAllocator::deallocate(p, size);
+        }
+
+        MetaTask get_return_object() noexcept
+        {
+            return MetaTask();
+        }
+        suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void() noexcept
+        {
+        }
+        void unhandled_exception()
+        {
+            terminate();
+        }
+    };
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// The awaitable returned by MetaClass::call(). Holds the arguments moved in, and the
+/// result, constructed in place, in the frame of the awaiting coroutine; that frame is
+/// allocated by the awaiting coroutine, from MetaBlockAllocator only for a MetaTask.
+/// Awaiting an unresolved call completes at once with a value initialized result, or an
+/// empty optional for the return types which cannot be default constructed, see isValid().
+///
+template<typename TReturnType, typename... Arguments>
+class MetaCall
+{
+    friend class MetaClass;
+    typedef typename conditional<is_void<TReturnType>::value, char, TReturnType>::type Result;
+
+    MetaScheduler &m_scheduler;
+    const MetaMethodRecord *m_method;
+    MetaObject *m_object;
+    typedef tuple<typename decay<Arguments>::type...> Tuple;
+    Tuple m_arguments;
+    alignas(Result) unsigned char m_result[sizeof(Result)];
+    bool m_hasResult = false;
+    coroutine_handle<> m_awaiting;
+
+    template<size_t... Indexes>
+    void invoke(index_sequence<Indexes...>)
+    {
+        // the arguments are moved into the by-value parameters
+        void *argv[] = { static_cast<void*>(addressof(std::get<Indexes>(m_arguments)))..., nullptr };
+        const uint64_t flags = metainvoker::movable<typename tuple_element<Indexes, Tuple>::type...>();
+        if constexpr (is_void<TReturnType>::value) {
+            m_method->callPacked(m_object, nullptr, argv, flags);
+        } else {
+            m_method->callPacked(m_object, m_result, argv, flags | metainvoker::ConstructReturn);
+            m_hasResult = true;
+        }
+    }
+
+    static void run(void *context)
+    {
+        MetaCall *call = static_cast<MetaCall*>(context);
+        call->invoke(index_sequence_for<Arguments...>());
+        call->m_awaiting.resume();
+    }
+
+    MetaCall(MetaScheduler &scheduler, const MetaMethodRecord *method, MetaObject *object, Arguments &&...args)
+        : m_scheduler(scheduler)
+        , m_method(method)
+        , m_object(object)
+        , m_arguments(forward<Arguments>(args)...)
+    {
+    }
+
+public:
+    MetaCall(const MetaCall &) = delete;
+    MetaCall &operator =(const MetaCall &) = delete;
+    ~MetaCall()
+    {
+        if (m_hasResult) {
+            reinterpret_cast<Result*>(m_result)->~Result();
+        }
+    }
+
+    // what awaiting the call results in, an optional for the return types which cannot be
+    // default constructed
+    typedef typename conditional<is_void<TReturnType>::value || is_default_constructible<TReturnType>::value,
+                                 TReturnType, optional<TReturnType>>::type Value;
+
+    // false if no method was found for the call
+    bool isValid() const
+    {
+        return m_method != nullptr;
+    }
+
+    bool await_ready() const noexcept
+    {
+        return !m_method;
+    }
+
+    bool await_suspend(coroutine_handle<> awaiting)
+    {
+        m_awaiting = awaiting;
+        if (m_scheduler.schedule(*m_method, MetaThreadPool::Task { &run, this })) {
+            return true;
+        }
+        invoke(index_sequence_for<Arguments...>());
+        return false;
+    }
+
+    Value await_resume()
+    {
+        if constexpr (!is_void<TReturnType>::value) {
+            if (!m_hasResult) {
+                return Value();
+            }
+            return Value(move(*reinterpret_cast<Result*>(m_result)));
+        }
+    }
+};
+
+template<typename TReturnType, typename... Arguments>
+MetaCall<TReturnType, Arguments...> MetaClass::call(MetaScheduler &scheduler, MetaObject *o, MetaSymbol name, Arguments... args)
+{
+    constexpr arguments::ArgContainer argTypes = arguments::signature<Arguments...>();
+    constexpr uint64_t signatureHash = arguments::signatureHash<TReturnType, Arguments...>();
+    const MetaMethodRecord *method = o->metaObject()->getMethod<TReturnType>(name, argTypes, signatureHash);
+    if (!method) {
+        metastats::recordMiss(o->metaObject(), name);
+    }
+    return MetaCall<TReturnType, Arguments...>(scheduler, method, o, move(args)...);
+}
+
+template<typename TReturnType, typename... Arguments>
+MetaCall<TReturnType, Arguments...> MetaClass::call(MetaObject *o, MetaSymbol name, Arguments... args)
+{
+    return call<TReturnType, Arguments...>(MetaScheduler::defaultScheduler(), o, name, move(args)...);
+}
+
+#endif // __cpp_impl_coroutine
+
+#endif // METACOROUTINE_H
@@ -0,0 +1,72 @@
+#include <iostream>
+#include <cstdlib>
+#include <cxxabi.h>
+#include "metaclass.h"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Prints the classes and the methods of a MetaImage file, see MetaImage::write().
+///
+static string typeName(const MetaImage &image, const arguments::ArgumentType &type)
+{
+    const string_view mangled = image.text(image.type(type).name);
+    string name = type.typeId() == MetaType::Undefined ? string("void") : string(mangled);
+    int status = 0;
+    if (char *demangled = abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status)) {
+        name = demangled;
+        free(demangled);
+    }
+    if (type.isConst() && !type.isPointer()) {
+        name = "const " + name;
+    }
+    if (type.isRValue()) {
+        name += "&&";
+    } else if (type.isRef()) {
+        name += "&";
+    }
+    return name;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        cerr << "usage: " << argv[0] << " <image>" << endl;
+        return 1;
+    }
+    unique_ptr<MetaImage> image = MetaImage::open(argv[1]);
+    if (!image) {
+        cerr << argv[1] << ": not a metamethod image of version " << MetaImage::Version << endl;
+        return 1;
+    }
+    const MetaImage::Header &header = image->header();
+    cout << "image version " << header.version << ": " << header.classCount << " classes, "
+         << header.methodCount << " methods, " << header.typeCount << " types, " << header.size << " bytes" << endl;
+
+    span<const MetaImage::Class> classes = image->classes();
+    for (const MetaImage::Class &c : classes) {
+        cout << endl << "class " << image->text(c.name);
+        if (c.super != MetaImage::NoClass) {
+            cout << " : " << image->text(classes[c.super].name);
+        }
+        cout << endl;
+        for (const MetaImage::Method &method : image->methods(c)) {
+            span<const arguments::ArgumentType> types = image->arguments(method);
+            cout << "    " << typeName(*image, types[0]) << " " << image->text(method.name) << "(";
+            for (size_t i = 1; i < types.size(); ++i) {
+                cout << (i > 1 ? ", " : "") << typeName(*image, types[i]);
+            }
+            cout << ")";
+            // the class declaring an inherited method
+            const MetaImage::Class *owner = &c;
+            for (uint32_t i = 0; i < method.owner && owner->super != MetaImage::NoClass; ++i) {
+                owner = &classes[owner->super];
+            }
+            if (owner != &c) {
+                cout << " [" << image->text(owner->name) << "]";
+            }
+            cout << endl;
+        }
+    }
+    return 0;
+}
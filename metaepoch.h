@@ -0,0 +1,172 @@
+#ifndef METAEPOCH_H
+#define METAEPOCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Epoch based reclamation for the data shared with lock free readers.
+///
+/// Readers announce the global epoch while they hold a MetaEpoch::Guard; entering and
+/// leaving a guard is wait free. Writers replace the shared data and retire the old one,
+/// which is deleted once none of the readers entered before the retirement is still
+/// inside its guard.
+///
+class MetaEpoch
+{
+    struct Reader
+    {
+        // 0 while the thread is not reading
+        atomic<uint64_t> epoch = 0;
+        atomic<bool> used = false;
+        Reader *next = nullptr;
+    };
+
+    struct ThreadState
+    {
+        Reader *reader = nullptr;
+        int nesting = 0;
+
+        ~ThreadState()
+        {
+            if (reader) {
+                reader->used.store(false, memory_order_release);
+            }
+        }
+    };
+
+    struct Retired
+    {
+        void *object;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    struct RetiredList
+    {
+        mutex lock;
+        vector<Retired> objects;
+
+        // no readers are left when the process exits
+        ~RetiredList()
+        {
+            for (Retired &retired : objects) {
+                retired.deleter(retired.object);
+            }
+        }
+    };
+
+    static inline atomic<uint64_t> s_epoch = 1;
+    // the reader records are never freed, the records of finished threads are reused
+    static inline atomic<Reader*> s_readers = nullptr;
+
+    static ThreadState &threadState()
+    {
+        static thread_local ThreadState state;
+        return state;
+    }
+
+    static RetiredList &retiredList()
+    {
+        static RetiredList list;
+        return list;
+    }
+
+    static Reader *acquireReader()
+    {
+        for (Reader *reader = s_readers.load(memory_order_acquire); reader; reader = reader->next) {
+            bool used = false;
+            if (!reader->used.load(memory_order_relaxed) &&
+                reader->used.compare_exchange_strong(used, true, memory_order_acquire)) {
+                return reader;
+            }
+        }
+        Reader *reader = new Reader;
+        reader->used.store(true, memory_order_relaxed);
+        reader->next = s_readers.load(memory_order_relaxed);
+        while (!s_readers.compare_exchange_weak(reader->next, reader, memory_order_release, memory_order_relaxed)) {
+        }
+        return reader;
+    }
+
+    // the smallest epoch announced by the readers inside a guard
+    static uint64_t oldestReader()
+    {
+        uint64_t oldest = UINT64_MAX;
+        for (Reader *reader = s_readers.load(memory_order_acquire); reader; reader = reader->next) {
+            const uint64_t epoch = reader->epoch.load(memory_order_seq_cst);
+            if (epoch && epoch < oldest) {
+                oldest = epoch;
+            }
+        }
+        return oldest;
+    }
+
+public:
+    static void enter()
+    {
+        ThreadState &state = threadState();
+        if (state.nesting++ == 0) {
+            if (!state.reader) {
+                state.reader = acquireReader();
+            }
+            state.reader->epoch.store(s_epoch.load(memory_order_seq_cst), memory_order_seq_cst);
+        }
+    }
+
+    static void leave()
+    {
+        ThreadState &state = threadState();
+        if (--state.nesting == 0) {
+            state.reader->epoch.store(0, memory_order_release);
+        }
+    }
+
+    class Guard
+    {
+    public:
+        Guard()
+        {
+            enter();
+        }
+        ~Guard()
+        {
+            leave();
+        }
+        Guard(const Guard &) = delete;
+        Guard &operator =(const Guard &) = delete;
+    };
+
+    // deletes the object once the readers which may still see it left their guards; the
+    // object must be unreachable for new readers before it is retired
+    template<typename T>
+    static void retire(const T *object)
+    {
+        RetiredList &list = retiredList();
+        lock_guard<mutex> lock(list.lock);
+        list.objects.push_back(Retired { const_cast<T*>(object), [](void *p) { delete static_cast<T*>(p); },
+                                         s_epoch.fetch_add(1, memory_order_seq_cst) });
+        collect(list);
+    }
+
+private:
+    static void collect(RetiredList &list)
+    {
+        const uint64_t oldest = oldestReader();
+        auto end = remove_if(list.objects.begin(), list.objects.end(), [oldest](Retired &retired) {
+            if (retired.epoch < oldest) {
+                retired.deleter(retired.object);
+                return true;
+            }
+            return false;
+        });
+        list.objects.erase(end, list.objects.end());
+    }
+};
+
+#endif // METAEPOCH_H
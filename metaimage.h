@@ -0,0 +1,488 @@
+#ifndef METAIMAGE_H
+#define METAIMAGE_H
+
+// included by metaclass.h
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// A file holding the metadata of the registered classes: the class hierarchy, the names
+/// and the signatures of the methods, and the types of the arguments. The file has no
+/// pointers, the records refer to each other by index and to the strings by offset, so
+/// it is used as it is mapped:
+///
+///     Header | Class[classCount] | Method[methodCount] | uint32_t[argumentCount] |
+///     Type[typeCount] | strings
+///
+/// The classes are sorted by the symbols of their names. The methods of a class are the
+/// ones it dispatches to, sorted by symbol; the overloads keep the order of the class, the
+/// own methods first. The arguments are ArgumentType values, the return type first, with
+/// the type ids indexing the type table.
+///
+/// Installed with install(), the image replaces the lookup tables of the classes declared
+/// with METATABLE_BEGIN, which need no registration then. The methods are bound to the
+/// records of the running program by their symbol and signature hash on the first lookup
+/// of a symbol, so the image must come from the same build.
+///
+class MetaImage
+{
+public:
+    static constexpr uint32_t Version = 1;
+    static constexpr uint32_t NoClass = 0xffffffff;
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t classCount;
+        uint32_t methodCount;
+        uint32_t argumentCount;
+        uint32_t typeCount;
+        uint32_t stringSize;
+        uint64_t classes;
+        uint64_t methods;
+        uint64_t arguments;
+        uint64_t types;
+        uint64_t strings;
+        // of the whole file
+        uint64_t size;
+    };
+
+    struct Class
+    {
+        uint64_t symbol;
+        uint32_t name;
+        // the index of the super class, NoClass for the root classes
+        uint32_t super;
+        uint32_t firstMethod;
+        uint32_t methodCount;
+    };
+
+    struct Method
+    {
+        uint64_t symbol;
+        uint64_t signatureHash;
+        uint32_t name;
+        // the number of super classes between the class and the class declaring the method
+        uint32_t owner;
+        uint32_t firstArgument;
+        uint32_t argumentCount;
+    };
+
+    struct Type
+    {
+        uint32_t name;
+        uint32_t size;
+        uint32_t alignment;
+        uint32_t reserved;
+    };
+
+private:
+    static constexpr char Magic[8] = { 'M', 'E', 'T', 'A', 'I', 'M', 'G', '\0' };
+
+    // the overloads of a symbol bound to the records of the program; kept at the index of
+    // the first overload
+    struct Binding
+    {
+        atomic<bool> bound = false;
+        uint32_t size = 0;
+        uint32_t declared = 0;
+    };
+
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+    const Header *m_header = nullptr;
+    const Class *m_classes = nullptr;
+    const Method *m_methods = nullptr;
+    const uint32_t *m_arguments = nullptr;
+    const Type *m_types = nullptr;
+    const char *m_strings = nullptr;
+    unique_ptr<const MetaMethodRecord*[]> m_records;
+    unique_ptr<Binding[]> m_bindings;
+    // the bindings of a class look the records of its super classes up
+    mutable recursive_mutex m_bindLock;
+
+    static inline atomic<const MetaImage*> s_installed = nullptr;
+
+    MetaImage() = default;
+
+    template<typename T>
+    bool section(uint64_t offset, uint64_t count, const T *&records) const
+    {
+        if (offset % alignof(T) || offset > m_size || count > (m_size - offset) / sizeof(T)) {
+            return false;
+        }
+        records = reinterpret_cast<const T*>(m_data + offset);
+        return true;
+    }
+
+    bool validate()
+    {
+        if (m_size < sizeof(Header)) {
+            return false;
+        }
+        m_header = reinterpret_cast<const Header*>(m_data);
+        const Header &h = *m_header;
+        if (memcmp(h.magic, Magic, sizeof(Magic)) || h.version != Version || h.size != m_size) {
+            return false;
+        }
+        if (!section(h.classes, h.classCount, m_classes) || !section(h.methods, h.methodCount, m_methods) ||
+            !section(h.arguments, h.argumentCount, m_arguments) || !section(h.types, h.typeCount, m_types) ||
+            !section(h.strings, h.stringSize, m_strings) || !h.stringSize || m_strings[h.stringSize - 1]) {
+            return false;
+        }
+        for (const Class &c : span(m_classes, h.classCount)) {
+            if (c.name >= h.stringSize || (c.super != NoClass && c.super >= h.classCount) ||
+                c.firstMethod > h.methodCount || c.methodCount > h.methodCount - c.firstMethod) {
+                return false;
+            }
+        }
+        for (const Method &m : span(m_methods, h.methodCount)) {
+            if (m.name >= h.stringSize || !m.argumentCount ||
+                m.firstArgument > h.argumentCount || m.argumentCount > h.argumentCount - m.firstArgument) {
+                return false;
+            }
+        }
+        for (const uint32_t argument : span(m_arguments, h.argumentCount)) {
+            if ((argument & arguments::ArgumentType::TypeIdMask) >= h.typeCount) {
+                return false;
+            }
+        }
+        for (const Type &t : span(m_types, h.typeCount)) {
+            if (t.name >= h.stringSize) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // the record of the program declaring the method of the image, null if there is none
+    static const MetaMethodRecord *bind(const MetaClass *metaClass, const Method &method)
+    {
+        const MetaClass *owner = metaClass;
+        for (uint32_t i = 0; owner && i < method.owner; ++i) {
+            owner = owner->m_superClass;
+        }
+        if (!owner) {
+            return nullptr;
+        }
+        MetaMethodTable::Range table = owner->m_table.find(method.symbol);
+        for (MetaMethodTable::Iterator i = table.first; i != table.second; ++i) {
+            if ((*i)->signatureHash() == method.signatureHash) {
+                return *i;
+            }
+        }
+        if (owner == metaClass) {
+            return nullptr;
+        }
+        MetaClass::MetaMethodRange declared = owner->declaredMethods(MetaSymbol::fromId(method.symbol));
+        for (MetaClass::MetaMethodIterator i = declared.first; i != declared.second; ++i) {
+            if ((*i)->signatureHash() == method.signatureHash) {
+                return *i;
+            }
+        }
+        return nullptr;
+    }
+
+    void bind(const MetaClass *metaClass, size_t first, size_t count) const
+    {
+        lock_guard<recursive_mutex> lock(m_bindLock);
+        Binding &binding = m_bindings[first];
+        if (binding.bound.load(memory_order_relaxed)) {
+            return;
+        }
+        // the overloads missing from the program are left out
+        uint32_t size = 0;
+        uint32_t declared = 0;
+        for (size_t i = first; i < first + count; ++i) {
+            if (const MetaMethodRecord *record = bind(metaClass, m_methods[i])) {
+                m_records[first + size++] = record;
+                declared += m_methods[i].owner == 0;
+            }
+        }
+        binding.size = size;
+        binding.declared = declared;
+        binding.bound.store(true, memory_order_release);
+    }
+
+public:
+    ~MetaImage()
+    {
+        if (m_data) {
+            munmap(const_cast<char*>(m_data), m_size);
+        }
+    }
+    MetaImage(const MetaImage &) = delete;
+    MetaImage &operator =(const MetaImage &) = delete;
+
+    // maps the image file; null if the file cannot be read or is not a valid image
+    static unique_ptr<MetaImage> open(const string &path)
+    {
+        const int file = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (file < 0) {
+            return nullptr;
+        }
+        struct stat status;
+        void *data = MAP_FAILED;
+        if (fstat(file, &status) == 0 && status.st_size > 0) {
+            data = mmap(nullptr, size_t(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+        }
+        close(file);
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+        unique_ptr<MetaImage> image(new MetaImage);
+        image->m_data = static_cast<const char*>(data);
+        image->m_size = size_t(status.st_size);
+        if (!image->validate()) {
+            return nullptr;
+        }
+        image->m_records.reset(new const MetaMethodRecord*[image->m_header->methodCount]);
+        image->m_bindings.reset(new Binding[image->m_header->methodCount]);
+        return image;
+    }
+
+    // writes the image of the classes initialized so far which have a name
+    static bool write(const string &path)
+    {
+        vector<const MetaClass*> classes;
+        for (const MetaClass *metaClass : MetaClass::classes()) {
+            if (metaClass->name()) {
+                classes.push_back(metaClass);
+            }
+        }
+        sort(classes.begin(), classes.end(), [](const MetaClass *a, const MetaClass *b) {
+            return MetaSymbol(a->name()).id() < MetaSymbol(b->name()).id();
+        });
+        unordered_map<const MetaClass*, uint32_t> indexes;
+        for (uint32_t i = 0; i < classes.size(); ++i) {
+            indexes[classes[i]] = i;
+        }
+
+        string strings(1, '\0');
+        unordered_map<string, uint32_t> stringOffsets;
+        auto addString = [&strings, &stringOffsets](string_view text) {
+            auto [offset, added] = stringOffsets.try_emplace(string(text), uint32_t(strings.size()));
+            if (added) {
+                strings.append(text);
+                strings.push_back('\0');
+            }
+            return offset->second;
+        };
+
+        vector<Class> classRecords;
+        vector<Method> methodRecords;
+        vector<uint32_t> argumentRecords;
+        {
+            MetaEpoch::Guard guard;
+            for (const MetaClass *metaClass : classes) {
+                Class record { MetaSymbol(metaClass->name()).id(), addString(metaClass->name()), NoClass,
+                               uint32_t(methodRecords.size()), 0 };
+                if (metaClass->m_superClass) {
+                    auto super = indexes.find(metaClass->m_superClass);
+                    record.super = super != indexes.end() ? super->second : NoClass;
+                }
+                vector<Method> methods;
+                metaClass->forEachMethods(metaClass->snapshot(), false, [&](uint64_t symbol, MetaClass::MetaMethodRange range) {
+                    for (const MetaMethodRecord *method : span(range.first, range.second)) {
+                        Method entry { symbol, method->signatureHash(), addString(method->name()), 0,
+                                       uint32_t(argumentRecords.size()), uint32_t(method->argumentCount() + 1) };
+                        for (const MetaClass *c = metaClass; c; c = c->m_superClass, ++entry.owner) {
+                            MetaClass::MetaMethodRange declared = c->declaredMethods(MetaSymbol::fromId(symbol));
+                            if (find(declared.first, declared.second, method) != declared.second) {
+                                break;
+                            }
+                        }
+                        argumentRecords.push_back(method->returnType().m_value);
+                        for (arguments::ArgIterator a = method->argumentsBegin(); a != method->argumentsEnd(); ++a) {
+                            argumentRecords.push_back(a->m_value);
+                        }
+                        methods.push_back(entry);
+                    }
+                });
+                stable_sort(methods.begin(), methods.end(), [](const Method &a, const Method &b) {
+                    return a.symbol < b.symbol;
+                });
+                methodRecords.insert(methodRecords.end(), methods.begin(), methods.end());
+                record.methodCount = uint32_t(methods.size());
+                classRecords.push_back(record);
+            }
+        }
+
+        vector<Type> typeRecords;
+        for (int typeId = 0; typeId < MetaType::count(); ++typeId) {
+            const MetaType::Info &info = MetaType::info(typeId);
+            typeRecords.push_back(Type { addString(info.type->name()), uint32_t(info.size), uint32_t(info.alignment), 0 });
+        }
+
+        Header header = {};
+        memcpy(header.magic, Magic, sizeof(Magic));
+        header.version = Version;
+        header.classCount = uint32_t(classRecords.size());
+        header.methodCount = uint32_t(methodRecords.size());
+        header.argumentCount = uint32_t(argumentRecords.size());
+        header.typeCount = uint32_t(typeRecords.size());
+        header.stringSize = uint32_t(strings.size());
+        // the sections are laid out in the order of their alignments
+        header.classes = sizeof(Header);
+        header.methods = header.classes + classRecords.size() * sizeof(Class);
+        header.arguments = header.methods + methodRecords.size() * sizeof(Method);
+        header.types = header.arguments + argumentRecords.size() * sizeof(uint32_t);
+        header.strings = header.types + typeRecords.size() * sizeof(Type);
+        header.size = header.strings + strings.size();
+
+        // written next to the target and renamed, the mapped images of the old file stay valid
+        const string temporary = path + ".tmp";
+        FILE *file = fopen(temporary.c_str(), "wb");
+        if (!file) {
+            return false;
+        }
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(classRecords.data(), sizeof(Class), classRecords.size(), file);
+        fwrite(methodRecords.data(), sizeof(Method), methodRecords.size(), file);
+        fwrite(argumentRecords.data(), sizeof(uint32_t), argumentRecords.size(), file);
+        fwrite(typeRecords.data(), sizeof(Type), typeRecords.size(), file);
+        fwrite(strings.data(), 1, strings.size(), file);
+        const bool written = !ferror(file);
+        if (fclose(file) != 0 || !written) {
+            remove(temporary.c_str());
+            return false;
+        }
+        return rename(temporary.c_str(), path.c_str()) == 0;
+    }
+
+    // makes the classes in the image look their methods up in it, the ones initialized
+    // already and the ones initialized later; null uninstalls the image. The image must
+    // stay open while installed.
+    static void install(const MetaImage *image)
+    {
+        lock_guard<mutex> lock(MetaClass::s_registryLock);
+        s_installed.store(image, memory_order_release);
+        for (const MetaClass *metaClass : MetaClass::s_classes) {
+            const MetaClass::Snapshot *snapshot = metaClass->m_snapshot.load(memory_order_relaxed);
+            if (!metaClass->publishImage() && snapshot->image) {
+                metaClass->publish();
+            }
+        }
+        MetaClass::s_generation.fetch_add(1, memory_order_release);
+    }
+
+    static const MetaImage *installed()
+    {
+        return s_installed.load(memory_order_acquire);
+    }
+
+    const Header &header() const
+    {
+        return *m_header;
+    }
+    span<const Class> classes() const
+    {
+        return span(m_classes, m_header->classCount);
+    }
+    span<const Method> methods(const Class &c) const
+    {
+        return span(m_methods + c.firstMethod, c.methodCount);
+    }
+    span<const arguments::ArgumentType> arguments(const Method &method) const
+    {
+        return span(reinterpret_cast<const arguments::ArgumentType*>(m_arguments + method.firstArgument), method.argumentCount);
+    }
+    const Type &type(const arguments::ArgumentType &argument) const
+    {
+        return m_types[argument.typeId()];
+    }
+    string_view text(uint32_t offset) const
+    {
+        return string_view(m_strings + offset);
+    }
+
+    // the index of the class with the name, NoClass if the image has no such class
+    uint32_t findClass(string_view name) const
+    {
+        const uint64_t symbol = MetaSymbol(name).id();
+        const Class *begin = m_classes;
+        const Class *end = m_classes + m_header->classCount;
+        const Class *found = lower_bound(begin, end, symbol, [](const Class &c, uint64_t symbol) {
+            return c.symbol < symbol;
+        });
+        for (; found != end && found->symbol == symbol; ++found) {
+            if (text(found->name) == name) {
+                return uint32_t(found - begin);
+            }
+        }
+        return NoClass;
+    }
+
+    // true if the class of the program has the super class and the own methods of the one
+    // in the image
+    bool matches(const MetaClass *metaClass, uint32_t classIndex) const
+    {
+        const Class &c = m_classes[classIndex];
+        const MetaClass *super = metaClass->m_superClass;
+        if ((c.super == NoClass) != (!super || !super->m_name) ||
+            (c.super != NoClass && text(m_classes[c.super].name) != super->m_name)) {
+            return false;
+        }
+        size_t declared = 0;
+        for (const Method &method : methods(c)) {
+            declared += method.owner == 0;
+        }
+        return declared == metaClass->m_table.size();
+    }
+
+    // the overloads of the symbol in the class, bound to the records of the program on the
+    // first lookup; either all or only the declared ones
+    MetaClass::MetaMethodRange methods(const MetaClass *metaClass, uint32_t classIndex, uint64_t symbol, bool declared) const
+    {
+        const Class &c = m_classes[classIndex];
+        const Method *begin = m_methods + c.firstMethod;
+        const Method *end = begin + c.methodCount;
+        const Method *first = lower_bound(begin, end, symbol, [](const Method &method, uint64_t symbol) {
+            return method.symbol < symbol;
+        });
+        if (first == end || first->symbol != symbol) {
+            return MetaClass::MetaMethodRange(nullptr, nullptr);
+        }
+        const size_t index = size_t(first - m_methods);
+        const Binding &binding = m_bindings[index];
+        if (!binding.bound.load(memory_order_acquire)) {
+            const Method *last = first;
+            while (last != end && last->symbol == symbol) {
+                ++last;
+            }
+            bind(metaClass, index, size_t(last - first));
+        }
+        const MetaMethodRecord *const *records = m_records.get() + index;
+        return MetaClass::MetaMethodRange(records, records + (declared ? binding.declared : binding.size));
+    }
+
+    // calls f(symbol) for each symbol of the methods of the class
+    template<typename Function>
+    void forEachSymbol(uint32_t classIndex, Function f) const
+    {
+        const span<const Method> list = methods(m_classes[classIndex]);
+        for (size_t i = 0; i < list.size(); ++i) {
+            if (i == 0 || list[i].symbol != list[i - 1].symbol) {
+                f(list[i].symbol);
+            }
+        }
+    }
+};
+
+#endif // METAIMAGE_H
@@ -0,0 +1,400 @@
+#ifndef METASTATS_H
+#define METASTATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unistd.h>
+
+#include "metasymbol.h"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// The call statistics of the methods of a class, see MetaClass::stats(). Recorded only
+/// when built with METAMETHOD_STATS defined, and enabled with MetaStats::setEnabled().
+///
+class MetaStats
+{
+public:
+    // latency bucket i counts the calls which took [2^i, 2^(i+1)) ns
+    static constexpr size_t Buckets = 32;
+    // one call in SampleRate is timed
+    static constexpr uint64_t SampleRate = 32;
+
+    struct Method
+    {
+        string name;
+        uint64_t signatureHash = 0;
+        uint64_t calls = 0;
+        // the latencies of the sampled calls, one in SampleRate
+        array<uint64_t, Buckets> latency {};
+        uint64_t latencySum = 0;
+    };
+    // invocations which found no method for the name and arguments
+    struct Miss
+    {
+        string name;
+        uint64_t count = 0;
+    };
+
+    vector<Method> methods;
+    vector<Miss> misses;
+
+    static void setEnabled(bool enabled)
+    {
+        s_enabled.store(enabled, memory_order_relaxed);
+    }
+    static bool isEnabled()
+    {
+        return s_enabled.load(memory_order_relaxed);
+    }
+
+    // the className, if given, labels the entries
+    void writeJson(int fd, string_view className = string_view()) const
+    {
+        string out = "{";
+        if (!className.empty()) {
+            out += "\"class\": \"" + jsonEscaped(className) + "\", ";
+        }
+        out += "\"methods\": [";
+        for (const Method &method : methods) {
+            out += (&method == methods.data() ? "" : ", ");
+            out += "{\"name\": \"" + jsonEscaped(method.name) + "\", \"signature\": \"" + hex(method.signatureHash) +
+                   "\", \"calls\": " + to_string(method.calls) + ", \"sample_rate\": " + to_string(SampleRate) +
+                   ", \"latency_ns\": [";
+            for (size_t i = 0; i < Buckets; ++i) {
+                out += (i ? ", " : "") + to_string(method.latency[i]);
+            }
+            out += "], \"latency_sum_ns\": " + to_string(method.latencySum) + "}";
+        }
+        out += "], \"misses\": [";
+        for (const Miss &miss : misses) {
+            out += (&miss == misses.data() ? "" : ", ");
+            out += "{\"name\": \"" + jsonEscaped(miss.name) + "\", \"count\": " + to_string(miss.count) + "}";
+        }
+        out += "]}\n";
+        writeAll(fd, out);
+    }
+
+    // the latency histogram covers the sampled calls only, it is exported as such, and its
+    // count is not the one of metamethod_calls_total
+    void writePrometheus(int fd, string_view className = string_view()) const
+    {
+        const string classLabel = className.empty() ? string() : "class=\"" + labelEscaped(className) + "\",";
+        string out = "# TYPE metamethod_calls_total counter\n";
+        for (const Method &method : methods) {
+            out += "metamethod_calls_total{" + classLabel + labels(method) + "} " + to_string(method.calls) + "\n";
+        }
+        out += "# HELP metamethod_sampled_latency_ns Latency of one call in " + to_string(SampleRate) + ".\n";
+        out += "# TYPE metamethod_sampled_latency_ns histogram\n";
+        for (const Method &method : methods) {
+            uint64_t count = 0;
+            for (size_t i = 0; i < Buckets; ++i) {
+                count += method.latency[i];
+                out += "metamethod_sampled_latency_ns_bucket{" + classLabel + labels(method) + ",le=\"" +
+                       to_string(uint64_t(2) << i) + "\"} " + to_string(count) + "\n";
+            }
+            out += "metamethod_sampled_latency_ns_bucket{" + classLabel + labels(method) + ",le=\"+Inf\"} " + to_string(count) + "\n";
+            out += "metamethod_sampled_latency_ns_sum{" + classLabel + labels(method) + "} " + to_string(method.latencySum) + "\n";
+            out += "metamethod_sampled_latency_ns_count{" + classLabel + labels(method) + "} " + to_string(count) + "\n";
+        }
+        out += "# TYPE metamethod_misses_total counter\n";
+        for (const Miss &miss : misses) {
+            out += "metamethod_misses_total{" + classLabel + "method=\"" + labelEscaped(miss.name) + "\"} " + to_string(miss.count) + "\n";
+        }
+        writeAll(fd, out);
+    }
+
+private:
+    static inline atomic<bool> s_enabled = false;
+
+    static string hex(uint64_t value)
+    {
+        char buffer[17];
+        snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)value);
+        return buffer;
+    }
+    // the names of the misses are the ones invoked, any string
+    static string jsonEscaped(string_view text)
+    {
+        string out;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char buffer[7];
+                snprintf(buffer, sizeof(buffer), "\\u%04x", unsigned(c));
+                out += buffer;
+            } else {
+                out += c;
+            }
+        }
+        return out;
+    }
+    static string labelEscaped(string_view text)
+    {
+        string out;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                out += '\\';
+                out += c;
+            } else if (c == '\n') {
+                out += "\\n";
+            } else {
+                out += c;
+            }
+        }
+        return out;
+    }
+    static string labels(const Method &method)
+    {
+        return "method=\"" + labelEscaped(method.name) + "\",signature=\"" + hex(method.signatureHash) + "\"";
+    }
+    static void writeAll(int fd, const string &out)
+    {
+        for (size_t written = 0; written < out.size();) {
+            const ssize_t result = write(fd, out.data() + written, out.size() - written);
+            if (result <= 0) {
+                return;
+            }
+            written += size_t(result);
+        }
+    }
+};
+
+namespace metastats
+{
+
+#if defined(METAMETHOD_STATS)
+
+struct Counters
+{
+    atomic<uint64_t> calls = 0;
+    atomic<uint64_t> latency[MetaStats::Buckets] = {};
+    atomic<uint64_t> latencySum = 0;
+};
+
+// the counters are written by their thread only, and read by the collecting ones
+inline void add(atomic<uint64_t> &counter, uint64_t value)
+{
+    counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// The counters of a thread, keyed by method record, or by class and symbol for the
+/// misses. Looked up without locking by the owner thread; the lock is taken when a key
+/// is inserted, and by the threads reading the counters.
+///
+class Table
+{
+    struct Slot
+    {
+        const void *key = nullptr;
+        uint64_t symbol = 0;
+        unique_ptr<Counters> counters;
+        string name;
+    };
+    vector<Slot> m_slots = vector<Slot>(64);
+    size_t m_count = 0;
+
+    size_t probe(const void *key, uint64_t symbol) const
+    {
+        const size_t mask = m_slots.size() - 1;
+        size_t i = size_t(((uint64_t(uintptr_t(key)) ^ symbol) * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+        while (m_slots[i].key && (m_slots[i].key != key || m_slots[i].symbol != symbol)) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+public:
+    mutex lock;
+
+    Counters &counters(const void *key, uint64_t symbol, string_view name)
+    {
+        Slot *slot = &m_slots[probe(key, symbol)];
+        if (slot->key) {
+            return *slot->counters;
+        }
+        lock_guard<mutex> guard(lock);
+        // keep the load factor under 50%
+        if (2 * (m_count + 1) > m_slots.size()) {
+            vector<Slot> slots(2 * m_slots.size());
+            slots.swap(m_slots);
+            for (Slot &old : slots) {
+                if (old.key) {
+                    m_slots[probe(old.key, old.symbol)] = move(old);
+                }
+            }
+            slot = &m_slots[probe(key, symbol)];
+        }
+        slot->counters.reset(new Counters);
+        slot->name = name;
+        slot->key = key;
+        slot->symbol = symbol;
+        ++m_count;
+        return *slot->counters;
+    }
+
+    // with the lock held
+    template<typename Function>
+    void forEach(Function f) const
+    {
+        for (const Slot &slot : m_slots) {
+            if (slot.key) {
+                f(slot.key, slot.symbol, slot.name, *slot.counters);
+            }
+        }
+    }
+};
+
+struct Registry
+{
+    mutex lock;
+    vector<Table*> tables;
+    // the counters of the finished threads
+    Table finished;
+};
+
+inline Registry &registry()
+{
+    static Registry registry;
+    return registry;
+}
+
+struct ThreadTable
+{
+    Table *table = new Table;
+
+    ThreadTable()
+    {
+        Registry &r = registry();
+        lock_guard<mutex> lock(r.lock);
+        r.tables.push_back(table);
+    }
+    ~ThreadTable()
+    {
+        Registry &r = registry();
+        lock_guard<mutex> lock(r.lock);
+        r.tables.erase(find(r.tables.begin(), r.tables.end(), table));
+        table->forEach([&r](const void *key, uint64_t symbol, const string &name, const Counters &counters) {
+            Counters &total = r.finished.counters(key, symbol, name);
+            add(total.calls, counters.calls.load(memory_order_relaxed));
+            for (size_t i = 0; i < MetaStats::Buckets; ++i) {
+                add(total.latency[i], counters.latency[i].load(memory_order_relaxed));
+            }
+            add(total.latencySum, counters.latencySum.load(memory_order_relaxed));
+        });
+        delete table;
+    }
+};
+
+inline Table &threadTable()
+{
+    static thread_local ThreadTable table;
+    return *table.table;
+}
+
+// the counters of the method called last on the thread; trivially destructible, so it is
+// accessed without the lazy initialization check of threadTable()
+struct LastMethod
+{
+    const void *record;
+    Counters *counters;
+};
+
+inline Counters &methodCounters(const void *record)
+{
+    static thread_local LastMethod last = { nullptr, nullptr };
+    if (last.record != record) {
+        last.counters = &threadTable().counters(record, 0, string_view());
+        last.record = record;
+    }
+    return *last.counters;
+}
+
+// sums up the counters of all the threads under the key
+template<typename Function>
+void collect(Function f)
+{
+    Registry &r = registry();
+    lock_guard<mutex> lock(r.lock);
+    {
+        lock_guard<mutex> tableLock(r.finished.lock);
+        r.finished.forEach(f);
+    }
+    for (Table *table : r.tables) {
+        lock_guard<mutex> tableLock(table->lock);
+        table->forEach(f);
+    }
+}
+
+// counts the call of the method it is created for, and times the sampled ones
+class Sample
+{
+    Counters *m_counters = nullptr;
+    chrono::steady_clock::time_point m_start;
+
+public:
+    explicit Sample(const void *record)
+    {
+        if (!MetaStats::isEnabled()) {
+            return;
+        }
+        Counters &counters = methodCounters(record);
+        const uint64_t calls = counters.calls.load(memory_order_relaxed) + 1;
+        counters.calls.store(calls, memory_order_relaxed);
+        if (calls % MetaStats::SampleRate == 0) {
+            m_counters = &counters;
+            m_start = chrono::steady_clock::now();
+        }
+    }
+    ~Sample()
+    {
+        if (m_counters) {
+            const uint64_t ns = uint64_t(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - m_start).count());
+            size_t bucket = 0;
+            while ((ns >> (bucket + 1)) && bucket + 1 < MetaStats::Buckets) {
+                ++bucket;
+            }
+            add(m_counters->latency[bucket], 1);
+            add(m_counters->latencySum, ns);
+        }
+    }
+};
+
+inline void recordMiss(const void *metaClass, const MetaSymbol &name)
+{
+    if (MetaStats::isEnabled()) {
+        add(threadTable().counters(metaClass, name.id(), name.name()).calls, 1);
+    }
+}
+
+#else
+
+class Sample
+{
+public:
+    explicit Sample(const void *)
+    {
+    }
+};
+
+inline void recordMiss(const void *, const MetaSymbol &)
+{
+}
+
+#endif // METAMETHOD_STATS
+
+} // namespace metastats
+
+#endif // METASTATS_H
@@ -0,0 +1,168 @@
+#ifndef METASYMBOL_H
+#define METASYMBOL_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// MetaSymbol is the interned form of a method name. The id is the 64 bit FNV-1a hash
+/// of the name, computed at compile time for literals, so lookups compare integers
+/// instead of strings. The name is kept only for diagnostics; it is a view, therefore
+/// it is only valid as long as the string the symbol was created from.
+///
+class MetaSymbol
+{
+    uint64_t m_id = 0;
+    string_view m_name;
+
+public:
+    static constexpr uint64_t hash(string_view name)
+    {
+        uint64_t h = 14695981039346656037ull;
+        for (char c : name) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 1099511628211ull;
+        }
+        // 0 marks the empty slots in the symbol tables
+        return h ? h : 1;
+    }
+
+    constexpr MetaSymbol() = default;
+    constexpr MetaSymbol(string_view name)
+        : m_id(hash(name))
+        , m_name(name)
+    {
+    }
+    constexpr MetaSymbol(const char *name)
+        : MetaSymbol(string_view(name))
+    {
+    }
+    MetaSymbol(const string &name)
+        : MetaSymbol(string_view(name))
+    {
+    }
+
+    // the symbol of an id received from elsewhere, without a name
+    static constexpr MetaSymbol fromId(uint64_t id)
+    {
+        MetaSymbol symbol;
+        symbol.m_id = id;
+        return symbol;
+    }
+
+    constexpr uint64_t id() const
+    {
+        return m_id;
+    }
+    constexpr string_view name() const
+    {
+        return m_name;
+    }
+    constexpr bool isValid() const
+    {
+        return m_id != 0;
+    }
+
+    constexpr bool operator ==(const MetaSymbol &that) const
+    {
+        return m_id == that.m_id;
+    }
+    constexpr bool operator !=(const MetaSymbol &that) const
+    {
+        return m_id != that.m_id;
+    }
+};
+
+// declares a symbol which is guaranteed to be hashed at compile time
+#define META_SYMBOL(name) \
+    []() { static constexpr MetaSymbol symbol(name); return symbol; }()
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Open addressing hash table keyed by symbol id. The ids are already well distributed
+/// hashes, so the slot is taken from the low bits of the id, and collisions are resolved
+/// with linear probing. Lookups do not allocate.
+///
+template<typename TValue>
+class MetaSymbolTable
+{
+    struct Slot
+    {
+        uint64_t key = 0;
+        TValue value;
+    };
+    vector<Slot> m_slots;
+    size_t m_count = 0;
+
+    size_t probe(uint64_t key) const
+    {
+        const size_t mask = m_slots.size() - 1;
+        size_t i = size_t(key) & mask;
+        while (m_slots[i].key && m_slots[i].key != key) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void rehash(size_t capacity)
+    {
+        vector<Slot> slots(capacity);
+        slots.swap(m_slots);
+        for (Slot &slot : slots) {
+            if (slot.key) {
+                Slot &target = m_slots[probe(slot.key)];
+                target.key = slot.key;
+                target.value = move(slot.value);
+            }
+        }
+    }
+
+public:
+    size_t size() const
+    {
+        return m_count;
+    }
+
+    TValue *find(uint64_t key)
+    {
+        if (!m_count) {
+            return nullptr;
+        }
+        Slot &slot = m_slots[probe(key)];
+        return slot.key ? &slot.value : nullptr;
+    }
+    const TValue *find(uint64_t key) const
+    {
+        return const_cast<MetaSymbolTable*>(this)->find(key);
+    }
+
+    // returns the value registered for the key, inserts a default one if there is none
+    TValue &operator[](uint64_t key)
+    {
+        // keep the load factor under 50%
+        if (2 * (m_count + 1) > m_slots.size()) {
+            rehash(m_slots.empty() ? 16 : 2 * m_slots.size());
+        }
+        Slot &slot = m_slots[probe(key)];
+        if (!slot.key) {
+            slot.key = key;
+            ++m_count;
+        }
+        return slot.value;
+    }
+
+    template<typename Function>
+    void forEach(Function f) const
+    {
+        for (const Slot &slot : m_slots) {
+            if (slot.key) {
+                f(slot.key, slot.value);
+            }
+        }
+    }
+};
+
+#endif // METASYMBOL_H
@@ -0,0 +1,231 @@
+#ifndef METATHREADPOOL_H
+#define METATHREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Work stealing pool of worker threads. Each worker has its own queue: tasks posted from
+/// a worker go to its own queue and are taken newest first, tasks posted from other
+/// threads are spread over the queues. Idle workers steal the oldest tasks of the others.
+///
+class MetaThreadPool
+{
+public:
+    // a function with its context; posting one costs no allocation besides the queue's
+    struct Task
+    {
+        void (*run)(void *context);
+        void *context;
+    };
+
+private:
+    struct Worker
+    {
+        mutex lock;
+        deque<Task> tasks;
+        thread runner;
+    };
+    struct Current
+    {
+        const MetaThreadPool *pool = nullptr;
+        size_t index = 0;
+    };
+
+    vector<unique_ptr<Worker>> m_workers;
+    // the tasks posted and not taken yet
+    atomic<size_t> m_pending = 0;
+    atomic<size_t> m_next = 0;
+    mutex m_sleepLock;
+    condition_variable m_wakeUp;
+    bool m_stopping = false;
+
+    // the pool and the index of the worker running on the calling thread
+    static Current &current()
+    {
+        static thread_local Current current;
+        return current;
+    }
+
+    bool take(size_t index, Task &task)
+    {
+        Worker &own = *m_workers[index];
+        {
+            lock_guard<mutex> lock(own.lock);
+            if (!own.tasks.empty()) {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < m_workers.size(); ++i) {
+            Worker &victim = *m_workers[(index + i) % m_workers.size()];
+            lock_guard<mutex> lock(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // removes the queued tasks with the context, not taken yet; returns how many
+    size_t revoke(void *context)
+    {
+        size_t revoked = 0;
+        for (unique_ptr<Worker> &worker : m_workers) {
+            lock_guard<mutex> lock(worker->lock);
+            auto end = remove_if(worker->tasks.begin(), worker->tasks.end(), [context](const Task &task) {
+                return task.context == context;
+            });
+            revoked += size_t(worker->tasks.end() - end);
+            worker->tasks.erase(end, worker->tasks.end());
+        }
+        m_pending.fetch_sub(revoked, memory_order_relaxed);
+        return revoked;
+    }
+
+    void work(size_t index)
+    {
+        current() = Current { this, index };
+        for (;;) {
+            Task task;
+            if (take(index, task)) {
+                m_pending.fetch_sub(1, memory_order_relaxed);
+                task.run(task.context);
+                continue;
+            }
+            unique_lock<mutex> lock(m_sleepLock);
+            m_wakeUp.wait(lock, [this]() { return m_stopping || m_pending.load() > 0; });
+            if (m_stopping && !m_pending.load()) {
+                return;
+            }
+        }
+    }
+
+public:
+    explicit MetaThreadPool(unsigned threads)
+    {
+        for (unsigned i = 0; i < max(threads, 1u); ++i) {
+            m_workers.emplace_back(new Worker);
+        }
+        for (size_t i = 0; i < m_workers.size(); ++i) {
+            m_workers[i]->runner = thread([this, i]() { work(i); });
+        }
+    }
+    // runs the tasks left in the queues before returning
+    ~MetaThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(m_sleepLock);
+            m_stopping = true;
+        }
+        m_wakeUp.notify_all();
+        for (unique_ptr<Worker> &worker : m_workers) {
+            worker->runner.join();
+        }
+    }
+
+    // the shared pool, with a worker for each core besides the calling one
+    static MetaThreadPool &instance()
+    {
+        static MetaThreadPool pool(max(thread::hardware_concurrency(), 2u) - 1);
+        return pool;
+    }
+
+    size_t threadCount() const
+    {
+        return m_workers.size();
+    }
+
+    void post(Task task)
+    {
+        const Current &caller = current();
+        Worker &worker = caller.pool == this ? *m_workers[caller.index]
+                                             : *m_workers[m_next.fetch_add(1, memory_order_relaxed) % m_workers.size()];
+        {
+            lock_guard<mutex> lock(worker.lock);
+            worker.tasks.push_back(task);
+        }
+        m_pending.fetch_add(1);
+        {
+            lock_guard<mutex> lock(m_sleepLock);
+        }
+        m_wakeUp.notify_one();
+    }
+
+    void post(function<void()> task)
+    {
+        post(Task { [](void *context) {
+                        unique_ptr<function<void()>> f(static_cast<function<void()>*>(context));
+                        (*f)();
+                    }, new function<void()>(move(task)) });
+    }
+
+    // calls f(begin, end) on chunks of [0, count) of at least grain items, on the workers and
+    // on the calling thread; returns when all the chunks are done
+    template<typename Function>
+    void parallelFor(size_t count, size_t grain, Function f)
+    {
+        const size_t chunks = min(count / max(grain, size_t(1)), threadCount() + 1);
+        if (chunks < 2) {
+            f(size_t(0), count);
+            return;
+        }
+        // on the stack of the caller, which revokes the helpers not started when it is done
+        // with the chunks and waits for the others to leave
+        struct Chunks
+        {
+            Function &f;
+            const size_t count;
+            const size_t chunks;
+            atomic<size_t> next = 0;
+            // the helpers posted and not returned, guarded by lock
+            size_t helpers;
+            mutex lock;
+            condition_variable finished;
+
+            Chunks(Function &f, size_t count, size_t chunks)
+                : f(f), count(count), chunks(chunks), helpers(chunks - 1)
+            {
+            }
+
+            void run()
+            {
+                for (size_t chunk = next++; chunk < chunks; chunk = next++) {
+                    f(chunk * count / chunks, (chunk + 1) * count / chunks);
+                }
+            }
+
+            static void help(void *context)
+            {
+                Chunks *state = static_cast<Chunks*>(context);
+                state->run();
+                lock_guard<mutex> lock(state->lock);
+                --state->helpers;
+                state->finished.notify_all();
+            }
+        };
+        Chunks state(f, count, chunks);
+        for (size_t i = 1; i < chunks; ++i) {
+            post(Task { &Chunks::help, &state });
+        }
+        state.run();
+        const size_t revoked = revoke(&state);
+        unique_lock<mutex> lock(state.lock);
+        state.helpers -= revoked;
+        state.finished.wait(lock, [&state]() { return state.helpers == 0; });
+    }
+};
+
+#endif // METATHREADPOOL_H
@@ -4,6 +4,7 @@
 #include <unordered_map>
 #include <functional>
 #include <typeindex>
+#include <mutex>
 
 #include "metatype.h"
 
@@ -13,30 +14,89 @@ using namespace std;
 typedef unordered_map<type_index, int> TypeIndexContainer;
 typedef TypeIndexContainer::const_iterator TypeIndexIterator;
 
-static TypeIndexContainer metaTypeContainer = {
-    make_pair(type_index(typeid(void)), MetaType::Undefined),
-    make_pair(type_index(typeid(bool)), MetaType::Bool),
-    make_pair(type_index(typeid(char)), MetaType::Char),
-    make_pair(type_index(typeid(unsigned char)), MetaType::UChar),
-    make_pair(type_index(typeid(short)), MetaType::Short),
-    make_pair(type_index(typeid(unsigned short)), MetaType::Word),
-    make_pair(type_index(typeid(int)), MetaType::Int),
-    make_pair(type_index(typeid(unsigned int)), MetaType::UInt),
-    make_pair(type_index(typeid(long int)), MetaType::Long),
-    make_pair(type_index(typeid(unsigned long int)), MetaType::ULong),
-    make_pair(type_index(typeid(long long)), MetaType::LongLong),
-    make_pair(type_index(typeid(unsigned long long)), MetaType::ULongLong),
-    make_pair(type_index(typeid(double)), MetaType::Double),
-    make_pair(type_index(typeid(float)), MetaType::Float),
-    make_pair(type_index(typeid(void*)), MetaType::VoidStar),
-    make_pair(type_index(typeid(char*)), MetaType::CharStar),
-    make_pair(type_index(typeid(int*)), MetaType::IntStar),
-    make_pair(type_index(typeid(std::string)), MetaType::String),
-    make_pair(type_index(typeid(std::vector<int>)), MetaType::IntVector),
+// the registry is created on first use, so types can be registered from static initializers;
+// the infos themselves are in MetaType::s_blocks, the registry only serves the lookups by
+// type_index
+struct TypeRegistry
+{
+    mutex lock;
+    TypeIndexContainer ids;
 };
 
+static TypeRegistry &typeRegistry()
+{
+    static TypeRegistry registry;
+    return registry;
+}
+
+void MetaType::initialize()
+{
+    static once_flag once;
+    call_once(once, []() {
+        using namespace metatype_impl;
+        // in the order of the TypeId enum
+        const Info builtins[] = {
+            typeInfo<void>(),
+            typeInfo<bool>(),
+            typeInfo<char>(),
+            typeInfo<unsigned char>(),
+            typeInfo<short>(),
+            typeInfo<unsigned short>(),
+            typeInfo<int>(),
+            typeInfo<unsigned int>(),
+            typeInfo<long int>(),
+            typeInfo<unsigned long int>(),
+            typeInfo<long long>(),
+            typeInfo<unsigned long long>(),
+            typeInfo<double>(),
+            typeInfo<float>(),
+            typeInfo<void*>(),
+            typeInfo<char*>(),
+            typeInfo<int*>(),
+            typeInfo<std::string>(),
+            typeInfo<std::vector<int>>(),
+        };
+        static_assert(sizeof(builtins) / sizeof(builtins[0]) == UserType, "the built-in types must match TypeId");
+        for (const Info &info : builtins) {
+            insert(info);
+        }
+    });
+}
+
+int MetaType::insert(const Info &info)
+{
+    TypeRegistry &registry = typeRegistry();
+    lock_guard<mutex> lock(registry.lock);
+    const size_t id = s_count.load(memory_order_relaxed);
+    auto result = registry.ids.insert(make_pair(type_index(*info.type), int(id)));
+    if (!result.second) {
+        return result.first->second;
+    }
+    if (id >= BlockSize * BlockCount) {
+        registry.ids.erase(result.first);
+        return -1;
+    }
+    Info *block = s_blocks[id / BlockSize].load(memory_order_relaxed);
+    if (!block) {
+        block = new Info[BlockSize]();
+        s_blocks[id / BlockSize].store(block, memory_order_relaxed);
+    }
+    block[id % BlockSize] = info;
+    s_count.store(id + 1, memory_order_release);
+    return int(id);
+}
+
 int MetaType::fromTypeIndex(const type_index &type)
 {
-    TypeIndexIterator i = metaTypeContainer.find(type);
-    return i == metaTypeContainer.cend() ? -1 : i->second;
+    initialize();
+    TypeRegistry &registry = typeRegistry();
+    lock_guard<mutex> lock(registry.lock);
+    TypeIndexIterator i = registry.ids.find(type);
+    return i == registry.ids.cend() ? -1 : i->second;
+}
+
+int MetaType::registerType(const Info &info)
+{
+    initialize();
+    return insert(info);
 }
@@ -1,17 +1,66 @@
 #ifndef METATYPE_H
 #define METATYPE_H
 
+#include <atomic>
+#include <concepts>
+#include <memory>
+#include <new>
 #include <typeindex>
-
-#include <boost/variant.hpp>
+#include <string>
+#include <vector>
+#include <type_traits>
 
 using namespace std;
 
+//////////////////////////////////////////////////////////////////////////////////////
+/// Tells that any bytes of the size of T make a valid T, so that a value can be read in
+/// place from untrusted memory, see MetaWire: the arithmetic types but bool. Specialize it
+/// for the user types holding such members only, no pointers, bools or enums:
+///
+///     template<> struct MetaRawValue<Point> : true_type {};
+///
+template<typename T>
+struct MetaRawValue : bool_constant<is_arithmetic<T>::value && !is_same<T, bool>::value> {};
+
 //////////////////////////////////////////////////////////////////////////////////////
 ///
 ///
 class MetaType
 {
+public:
+    // the layout and the value operations of a type; the operations a type does not support
+    // are null
+    struct Info
+    {
+        const type_info *type;
+        size_t size;
+        size_t alignment;
+        // the value can be copied bytewise
+        bool trivial;
+        // any bytes of the size make a valid value, see MetaRawValue
+        bool raw;
+        // default constructs a value in the uninitialized to
+        void (*construct)(void *to);
+        // constructs a copy of from in the uninitialized to
+        void (*copy)(void *to, const void *from);
+        // move constructs from from into the uninitialized to
+        void (*move)(void *to, void *from);
+        void (*destroy)(void *object);
+        bool (*equals)(const void *a, const void *b);
+    };
+
+private:
+    // the infos are kept in blocks which are never moved, so they are read without locking
+    static constexpr size_t BlockSize = 256;
+    static constexpr size_t BlockCount = 1024;
+    static inline atomic<Info*> s_blocks[BlockCount] = {};
+    // the ids below are registered
+    static inline atomic<size_t> s_count = 0;
+
+    // registers the built-in types if not done yet
+    static void initialize();
+    static int insert(const Info &info);
+
     int m_typeId = -1;
 
 public:
@@ -34,7 +83,9 @@ public:
         CharStar,
         IntStar,
         String,
-        IntVector
+        IntVector,
+        // the types registered at runtime get their ids from here on
+        UserType
     };
     explicit MetaType(int typeId)
         : m_typeId(typeId)
@@ -45,7 +96,176 @@ public:
     {
     }
 
+    int typeId() const
+    {
+        return m_typeId;
+    }
+    bool isValid() const
+    {
+        return m_typeId > Undefined && size_t(m_typeId) < s_count.load(memory_order_acquire);
+    }
+    const Info &info() const
+    {
+        return info(m_typeId);
+    }
+
+    // looks the type up by its type_index; -1 if the type is not registered
     static int fromTypeIndex(const type_index &type);
+
+    // returns the id of the type, registers the type if it is not known yet; the ids are dense
+    static int registerType(const Info &info);
+    template<typename T>
+    static int registerType();
+
+    // the info of the type registered with the id; the info of void for unknown ids
+    static const Info &info(int typeId)
+    {
+        if (size_t(typeId) >= s_count.load(memory_order_acquire)) {
+            initialize();
+            if (size_t(typeId) >= s_count.load(memory_order_acquire)) {
+                typeId = Undefined;
+            }
+        }
+        return s_blocks[size_t(typeId) / BlockSize].load(memory_order_relaxed)[size_t(typeId) % BlockSize];
+    }
+    // the ids below are registered
+    static int count()
+    {
+        initialize();
+        return int(s_count.load(memory_order_acquire));
+    }
+    // the type registered with the id; typeid(void) for unknown ids
+    static type_index typeIndex(int typeId)
+    {
+        return *info(typeId).type;
+    }
+
+    template<typename T>
+    static constexpr int typeId();
+
+    // the id of T; a constant for the built-in types. The ids of the other types are assigned
+    // during the dynamic initialization, use typeId() from the static initializers
+    template<typename T>
+    static const int id;
 };
 
+namespace metatype_impl
+{
+
+template<typename T>
+constexpr int builtinTypeId()
+{
+    return is_same<T, void>::value ? MetaType::Undefined :
+           is_same<T, bool>::value ? MetaType::Bool :
+           is_same<T, char>::value ? MetaType::Char :
+           is_same<T, unsigned char>::value ? MetaType::UChar :
+           is_same<T, short>::value ? MetaType::Short :
+           is_same<T, unsigned short>::value ? MetaType::Word :
+           is_same<T, int>::value ? MetaType::Int :
+           is_same<T, unsigned int>::value ? MetaType::UInt :
+           is_same<T, long int>::value ? MetaType::Long :
+           is_same<T, unsigned long int>::value ? MetaType::ULong :
+           is_same<T, long long>::value ? MetaType::LongLong :
+           is_same<T, unsigned long long>::value ? MetaType::ULongLong :
+           is_same<T, double>::value ? MetaType::Double :
+           is_same<T, float>::value ? MetaType::Float :
+           is_same<T, void*>::value ? MetaType::VoidStar :
+           is_same<T, char*>::value ? MetaType::CharStar :
+           is_same<T, int*>::value ? MetaType::IntStar :
+           is_same<T, std::string>::value ? MetaType::String :
+           is_same<T, std::vector<int>>::value ? MetaType::IntVector :
+           -1;
+}
+
+template<typename T>
+void construct(void *to)
+{
+    new (to) T();
+}
+
+template<typename T>
+void copy(void *to, const void *from)
+{
+    new (to) T(*static_cast<const T*>(from));
+}
+
+template<typename T>
+void move(void *to, void *from)
+{
+    new (to) T(std::move(*static_cast<T*>(from)));
+}
+
+template<typename T>
+void destroy(void *object)
+{
+    destroy_at(static_cast<T*>(object));
+}
+
+template<typename T>
+bool equals(const void *a, const void *b)
+{
+    return *static_cast<const T*>(a) == *static_cast<const T*>(b);
+}
+
+template<typename T>
+constexpr MetaType::Info typeInfo()
+{
+    if constexpr (is_void<T>::value) {
+        return MetaType::Info { &typeid(void), 0, 0, false, false, nullptr, nullptr, nullptr, nullptr, nullptr };
+    } else {
+        MetaType::Info info { &typeid(T), sizeof(T), alignof(T), is_trivially_copyable<T>::value,
+                              MetaRawValue<T>::value, nullptr, nullptr, nullptr, nullptr, nullptr };
+        if constexpr (is_default_constructible<T>::value) {
+            info.construct = &metatype_impl::construct<T>;
+        }
+        if constexpr (is_copy_constructible<T>::value) {
+            info.copy = &metatype_impl::copy<T>;
+        }
+        if constexpr (is_move_constructible<T>::value) {
+            info.move = &metatype_impl::move<T>;
+        }
+        if constexpr (is_destructible<T>::value) {
+            info.destroy = &metatype_impl::destroy<T>;
+        }
+        if constexpr (requires(const T &a, const T &b) { { a == b } -> convertible_to<bool>; }) {
+            info.equals = &metatype_impl::equals<T>;
+        }
+        return info;
+    }
+}
+
+template<typename T>
+int registeredTypeId()
+{
+    static const int id = MetaType::registerType<T>();
+    return id;
+}
+
+} // namespace metatype_impl
+
+template<typename T>
+int MetaType::registerType()
+{
+    typedef typename remove_cv<typename remove_reference<T>::type>::type Type;
+    static constexpr Info info = metatype_impl::typeInfo<Type>();
+    return registerType(info);
+}
+
+// the id of the type, without its reference and top level const qualifiers; the built-in
+// types have constant ids, the rest is registered on first use
+template<typename T>
+constexpr int MetaType::typeId()
+{
+    typedef typename remove_cv<typename remove_reference<T>::type>::type Type;
+    constexpr int builtin = metatype_impl::builtinTypeId<Type>();
+    if constexpr (builtin >= 0) {
+        return builtin;
+    } else {
+        return metatype_impl::registeredTypeId<Type>();
+    }
+}
+
+template<typename T>
+inline const int MetaType::id = MetaType::typeId<T>();
+
 #endif // METATYPE_H
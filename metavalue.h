@@ -0,0 +1,262 @@
+#ifndef METAVALUE_H
+#define METAVALUE_H
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "metatype.h"
+#include "metaallocator.h"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Holds a value of any registered MetaType. The values which fit InlineSize are stored
+/// in the object, the larger ones in a block of MetaBlockAllocator. The value is handled
+/// through the operations of its MetaType::Info, so the type has no vtable and can hold
+/// move-only values; MetaValue itself is move-only, see clone().
+///
+class MetaValue
+{
+public:
+    // the values up to this size and pointer alignment are stored inline
+    static constexpr size_t InlineSize = 24;
+
+private:
+    union
+    {
+        alignas(void*) unsigned char m_buffer[InlineSize];
+        void *m_data;
+    };
+    int m_typeId = MetaType::Undefined;
+    bool m_inline = true;
+
+    static constexpr bool fitsInline(size_t size, size_t alignment, bool movable)
+    {
+        // the inline values are moved when the MetaValue is, the others stay in place
+        return size <= InlineSize && alignment <= alignof(void*) && movable;
+    }
+
+    // allocates the storage for a value of the type; the type id is set once the value is
+    // constructed in it, see Construction
+    void *allocate(size_t size, size_t alignment, bool movable)
+    {
+        m_inline = fitsInline(size, alignment, movable);
+        if (m_inline) {
+            return m_buffer;
+        }
+        m_data = alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? ::operator new(size, align_val_t(alignment))
+                                                               : MetaBlockAllocator::allocate(size);
+        return m_data;
+    }
+
+    void deallocate(size_t size, size_t alignment)
+    {
+        if (!m_inline) {
+            if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+                ::operator delete(m_data, align_val_t(alignment));
+            } else {
+                MetaBlockAllocator::deallocate(m_data, size);
+            }
+        }
+        m_inline = true;
+    }
+
+    // the storage of a value being constructed; freed unless the construction completes,
+    // so a throwing constructor leaves the MetaValue empty
+    class Construction
+    {
+        MetaValue &m_value;
+        size_t m_size;
+        size_t m_alignment;
+        void *m_storage;
+
+    public:
+        Construction(MetaValue &value, size_t size, size_t alignment, bool movable)
+            : m_value(value)
+            , m_size(size)
+            , m_alignment(alignment)
+            , m_storage(value.allocate(size, alignment, movable))
+        {
+        }
+        ~Construction()
+        {
+            if (m_storage) {
+                m_value.deallocate(m_size, m_alignment);
+            }
+        }
+
+        void *storage() const
+        {
+            return m_storage;
+        }
+        // the value is constructed in the storage
+        void complete(int typeId)
+        {
+            m_value.m_typeId = typeId;
+            m_storage = nullptr;
+        }
+    };
+
+    void moveFrom(MetaValue &that)
+    {
+        if (!that.isValid()) {
+            return;
+        }
+        m_typeId = that.m_typeId;
+        m_inline = that.m_inline;
+        if (m_inline) {
+            const MetaType::Info &info = MetaType::info(m_typeId);
+            info.move(m_buffer, that.m_buffer);
+            info.destroy(that.m_buffer);
+        } else {
+            m_data = that.m_data;
+        }
+        that.m_typeId = MetaType::Undefined;
+        that.m_inline = true;
+    }
+
+public:
+    MetaValue()
+    {
+    }
+    // stores the value moved or copied in
+    template<typename T, typename = typename enable_if<!is_same<typename decay<T>::type, MetaValue>::value>::type>
+    MetaValue(T &&value)
+    {
+        emplace<typename decay<T>::type>(forward<T>(value));
+    }
+    MetaValue(MetaValue &&that)
+    {
+        moveFrom(that);
+    }
+    MetaValue &operator =(MetaValue &&that)
+    {
+        if (this != &that) {
+            reset();
+            moveFrom(that);
+        }
+        return *this;
+    }
+    MetaValue(const MetaValue &) = delete;
+    MetaValue &operator =(const MetaValue &) = delete;
+    ~MetaValue()
+    {
+        reset();
+    }
+
+    // constructs a T from the arguments, replacing the current value
+    template<typename T, typename... Arguments>
+    T &emplace(Arguments &&...args)
+    {
+        reset();
+        Construction construction(*this, sizeof(T), alignof(T), is_move_constructible<T>::value);
+        T &value = *new (construction.storage()) T(forward<Arguments>(args)...);
+        construction.complete(MetaType::typeId<T>());
+        return value;
+    }
+
+    // constructs a value of the registered type with constructor(storage), replacing the
+    // current value; returns false and leaves the value empty if the type is unknown
+    template<typename Constructor>
+    bool construct(int typeId, Constructor constructor)
+    {
+        reset();
+        const MetaType::Info &info = MetaType::info(typeId);
+        if (typeId <= MetaType::Undefined || !info.destroy) {
+            return false;
+        }
+        Construction construction(*this, info.size, info.alignment, info.move != nullptr);
+        constructor(construction.storage());
+        construction.complete(typeId);
+        return true;
+    }
+
+    // default constructs a value of the registered type, replacing the current value; returns
+    // false and leaves the value empty if the type is unknown or not default constructible
+    bool emplace(int typeId)
+    {
+        const MetaType::Info &info = MetaType::info(typeId);
+        if (!info.construct) {
+            reset();
+            return false;
+        }
+        return construct(typeId, info.construct);
+    }
+
+    void reset()
+    {
+        if (!isValid()) {
+            return;
+        }
+        const MetaType::Info &info = MetaType::info(m_typeId);
+        info.destroy(data());
+        deallocate(info.size, info.alignment);
+        m_typeId = MetaType::Undefined;
+    }
+
+    // a copy of the value; empty if the type of the value is not copyable
+    MetaValue clone() const
+    {
+        MetaValue copy;
+        if (isValid()) {
+            const MetaType::Info &info = MetaType::info(m_typeId);
+            if (info.copy) {
+                Construction construction(copy, info.size, info.alignment, info.move != nullptr);
+                info.copy(construction.storage(), data());
+                construction.complete(m_typeId);
+            }
+        }
+        return copy;
+    }
+
+    bool isValid() const
+    {
+        return m_typeId != MetaType::Undefined;
+    }
+    int typeId() const
+    {
+        return m_typeId;
+    }
+    bool isInline() const
+    {
+        return m_inline;
+    }
+
+    void *data()
+    {
+        return m_inline ? static_cast<void*>(m_buffer) : m_data;
+    }
+    const void *data() const
+    {
+        return m_inline ? static_cast<const void*>(m_buffer) : m_data;
+    }
+
+    // the value, or null if the value is not a T
+    template<typename T>
+    T *value()
+    {
+        return m_typeId == MetaType::typeId<T>() ? static_cast<T*>(data()) : nullptr;
+    }
+    template<typename T>
+    const T *value() const
+    {
+        return m_typeId == MetaType::typeId<T>() ? static_cast<const T*>(data()) : nullptr;
+    }
+
+    // values of different types, or of types without equality, are not equal
+    bool operator ==(const MetaValue &that) const
+    {
+        if (m_typeId != that.m_typeId) {
+            return false;
+        }
+        if (!isValid()) {
+            return true;
+        }
+        const MetaType::Info &info = MetaType::info(m_typeId);
+        return info.equals && info.equals(data(), that.data());
+    }
+};
+
+#endif // METAVALUE_H
@@ -0,0 +1,824 @@
+#ifndef METAWIRE_H
+#define METAWIRE_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "metaclass.h"
+
+using namespace std;
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Binary format of the remote invokes. A message is a MetaWire::Header followed by the
+/// values, each at the offset aligned for its type, so the receiver reads them in place:
+///
+/// - the values of the MetaRawValue types are copied bytewise with the size of their
+///   MetaType; the receiver passes a pointer into the message to the method. A bool is a
+///   0 or a 1 byte, the messages with other values are malformed. The other types, such as
+///   the enums or the structs holding pointers, are not sent
+/// - string and string_view are a uint32_t length followed by the characters
+/// - vector<int> and span<const int> are a uint32_t count followed by the ints
+///
+/// string_view and span<const int> parameters are decoded into views of the message, the
+/// string and vector<int> ones are constructed from it. Requests carry the declared types,
+/// the ArgumentType words of the return type and of the arguments, then the arguments;
+/// responses the return value, if any. Messages start 16 byte aligned and end with the
+/// last value. The type ids of the user types are those of the sending process.
+///
+namespace MetaWire
+{
+
+enum Status : uint32_t {
+    Request,
+    Ok,
+    NoObject,
+    NoMethod,
+    BadMessage,
+    TransportError
+};
+
+struct Header
+{
+    // of the whole message, the header included
+    uint32_t size;
+    Status status;
+    uint64_t callId;
+    uint64_t symbol;
+    uint64_t signatureHash;
+    uint32_t object;
+    // of the request, the argument type words follow the header
+    uint32_t argumentCount;
+};
+static_assert(sizeof(Header) == 40, "the header layout is part of the format");
+
+static constexpr size_t MaxMessageSize = 64 * 1024;
+static constexpr size_t MaxArguments = MetaConversion::MaxArguments;
+
+enum class Encoding {
+    Raw,
+    Text,
+    IntArray,
+    None
+};
+
+template<typename T>
+constexpr Encoding encoding()
+{
+    typedef typename remove_cvref<T>::type Type;
+    if constexpr (is_same<Type, string>::value || is_same<Type, string_view>::value) {
+        return Encoding::Text;
+    } else if constexpr (is_same<Type, vector<int>>::value || is_same<Type, span<const int>>::value) {
+        return Encoding::IntArray;
+    } else if constexpr (is_void<Type>::value) {
+        return Encoding::None;
+    } else if constexpr (is_same<Type, bool>::value || MetaRawValue<Type>::value) {
+        static_assert(is_trivially_copyable<Type>::value, "the raw values are copied bytewise");
+        return Encoding::Raw;
+    } else {
+        return Encoding::None;
+    }
+}
+
+inline Encoding encoding(const arguments::ArgumentType &type)
+{
+    const int typeId = type.typeId();
+    if (type.isPointer() || typeId <= MetaType::Undefined) {
+        return Encoding::None;
+    }
+    if (typeId == MetaType::String || typeId == MetaType::typeId<string_view>()) {
+        return Encoding::Text;
+    }
+    if (typeId == MetaType::IntVector || typeId == MetaType::typeId<span<const int>>()) {
+        return Encoding::IntArray;
+    }
+    const MetaType::Info &info = MetaType::info(typeId);
+    return typeId == MetaType::Bool || (info.raw && info.trivial) ? Encoding::Raw : Encoding::None;
+}
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Builds a message. The buffer is kept between the messages, so a warm writer does not
+/// allocate.
+///
+class Writer
+{
+    // in max_align_t units, most calls fit
+    static constexpr size_t MinimumSize = 512 / sizeof(max_align_t);
+
+    vector<max_align_t> m_buffer;
+    size_t m_size = 0;
+
+public:
+    Header &begin()
+    {
+        m_size = 0;
+        return *static_cast<Header*>(reserve(sizeof(Header), alignof(Header)));
+    }
+
+    Header &header()
+    {
+        return *reinterpret_cast<Header*>(m_buffer.data());
+    }
+
+    // the storage of the next value; the pointers returned earlier are invalidated
+    void *reserve(size_t size, size_t alignment)
+    {
+        const size_t offset = (m_size + alignment - 1) & ~(alignment - 1);
+        m_size = offset + size;
+        if (m_size > m_buffer.size() * sizeof(max_align_t)) {
+            m_buffer.resize(max({ m_buffer.size() * 2, (m_size + sizeof(max_align_t) - 1) / sizeof(max_align_t), MinimumSize }));
+        }
+        return reinterpret_cast<char*>(m_buffer.data()) + offset;
+    }
+
+    void write(const void *data, size_t size, size_t alignment)
+    {
+        memcpy(reserve(size, alignment), data, size);
+    }
+
+    void writeText(string_view text)
+    {
+        const uint32_t length = uint32_t(text.size());
+        write(&length, sizeof(length), alignof(uint32_t));
+        write(text.data(), text.size(), 1);
+    }
+
+    void writeInts(span<const int> ints)
+    {
+        const uint32_t count = uint32_t(ints.size());
+        write(&count, sizeof(count), alignof(uint32_t));
+        write(ints.data(), ints.size_bytes(), alignof(int));
+    }
+
+    // writes the value as the type T
+    template<typename T, typename Value>
+    void write(Value &&value)
+    {
+        typedef typename remove_cvref<T>::type Type;
+        constexpr Encoding coding = encoding<Type>();
+        static_assert(coding != Encoding::None, "the type has no wire encoding");
+        if constexpr (coding == Encoding::Raw) {
+            const Type converted = value;
+            write(&converted, sizeof(Type), alignof(Type));
+        } else if constexpr (coding == Encoding::Text) {
+            writeText(string_view(value));
+        } else {
+            writeInts(span<const int>(value));
+        }
+    }
+
+    // the declared types of a request
+    template<typename TReturnType, typename... Arguments>
+    void writeTypes()
+    {
+        header().argumentCount = uint32_t(sizeof... (Arguments));
+        for (const uint32_t word : { arguments::ArgumentType::value<TReturnType>().m_value,
+                                     arguments::ArgumentType::value<Arguments>().m_value... }) {
+            write(&word, sizeof(word), alignof(uint32_t));
+        }
+    }
+
+    // writes the value of the registered type found at data
+    bool write(const arguments::ArgumentType &type, const void *data)
+    {
+        switch (encoding(type)) {
+        case Encoding::Raw: {
+            const MetaType::Info &info = MetaType::info(type.typeId());
+            write(data, info.size, info.alignment);
+            return true;
+        }
+        case Encoding::Text:
+            writeText(type.typeId() == MetaType::String ? string_view(*static_cast<const string*>(data))
+                                                        : *static_cast<const string_view*>(data));
+            return true;
+        case Encoding::IntArray:
+            writeInts(type.typeId() == MetaType::IntVector ? span<const int>(*static_cast<const vector<int>*>(data))
+                                                           : *static_cast<const span<const int>*>(data));
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // completes the message
+    span<const char> finish()
+    {
+        header().size = uint32_t(m_size);
+        return span<const char>(reinterpret_cast<const char*>(m_buffer.data()), m_size);
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Reads the values of a received message in place.
+///
+class Reader
+{
+    span<char> m_message;
+    size_t m_offset = sizeof(Header);
+
+    // null if the message is too short
+    char *take(size_t size, size_t alignment)
+    {
+        const size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+        if (offset + size > m_message.size()) {
+            return nullptr;
+        }
+        m_offset = offset + size;
+        return m_message.data() + offset;
+    }
+
+    // the byte holds a valid bool, the other values are undefined behavior to read as one
+    static bool isBool(char byte)
+    {
+        return byte == 0 || byte == 1;
+    }
+
+    template<typename Count>
+    bool takeCount(Count &count)
+    {
+        const char *data = take(sizeof(uint32_t), alignof(uint32_t));
+        if (!data) {
+            return false;
+        }
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        count = Count(value);
+        return true;
+    }
+
+public:
+    explicit Reader(span<char> message)
+        : m_message(message)
+    {
+    }
+
+    bool isValid() const
+    {
+        return m_message.size() >= sizeof(Header) && header().size == m_message.size();
+    }
+
+    const Header &header() const
+    {
+        return *reinterpret_cast<const Header*>(m_message.data());
+    }
+
+    // false if the message is too short
+    bool readWord(uint32_t &word)
+    {
+        return takeCount(word);
+    }
+
+    // all the values are read
+    bool atEnd() const
+    {
+        return m_offset == m_message.size();
+    }
+
+    string_view readText()
+    {
+        size_t length = 0;
+        if (!takeCount(length)) {
+            return string_view();
+        }
+        const char *text = take(length, 1);
+        return text ? string_view(text, length) : string_view();
+    }
+
+    span<const int> readInts()
+    {
+        size_t count = 0;
+        if (!takeCount(count)) {
+            return span<const int>();
+        }
+        const char *ints = take(count * sizeof(int), alignof(int));
+        return ints ? span<const int>(reinterpret_cast<const int*>(ints), count) : span<const int>();
+    }
+
+    // the value of the registered type, as the method parameter of the type takes it;
+    // the views and the constructed values are placed in slot. Null if the message is
+    // malformed or the type has no wire encoding.
+    void *read(const arguments::ArgumentType &type, MetaValue &slot)
+    {
+        switch (encoding(type)) {
+        case Encoding::Raw: {
+            const MetaType::Info &info = MetaType::info(type.typeId());
+            char *data = take(info.size, info.alignment);
+            if (data && type.typeId() == MetaType::Bool && !isBool(*data)) {
+                return nullptr;
+            }
+            return data;
+        }
+        case Encoding::Text: {
+            const size_t before = m_offset;
+            const string_view text = readText();
+            if (m_offset == before) {
+                return nullptr;
+            }
+            if (type.typeId() == MetaType::String) {
+                return &slot.emplace<string>(text);
+            }
+            return &slot.emplace<string_view>(text);
+        }
+        case Encoding::IntArray: {
+            const size_t before = m_offset;
+            const span<const int> ints = readInts();
+            if (m_offset == before) {
+                return nullptr;
+            }
+            if (type.typeId() == MetaType::IntVector) {
+                return &slot.emplace<vector<int>>(ints.begin(), ints.end());
+            }
+            return &slot.emplace<span<const int>>(ints);
+        }
+        default:
+            return nullptr;
+        }
+    }
+
+    // reads the value into the T
+    template<typename T>
+    bool read(T &value)
+    {
+        constexpr Encoding coding = encoding<T>();
+        static_assert(coding != Encoding::None, "the type has no wire encoding");
+        if constexpr (coding == Encoding::Raw) {
+            const char *data = take(sizeof(T), alignof(T));
+            if (!data) {
+                return false;
+            }
+            if constexpr (is_same<T, bool>::value) {
+                if (!isBool(*data)) {
+                    return false;
+                }
+            }
+            memcpy(static_cast<void*>(&value), data, sizeof(T));
+            return true;
+        } else {
+            const size_t before = m_offset;
+            const auto view = [this]() {
+                if constexpr (coding == Encoding::Text) {
+                    return readText();
+                } else {
+                    return readInts();
+                }
+            }();
+            if (m_offset == before) {
+                return false;
+            }
+            value = T(view.begin(), view.end());
+            return true;
+        }
+    }
+};
+
+} // namespace MetaWire
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Carries the messages between the client and the server.
+///
+class MetaTransport
+{
+public:
+    virtual ~MetaTransport() {}
+
+    virtual bool send(span<const char> message) = 0;
+    // the next message, valid until the next receive(); empty once the other end is closed
+    virtual span<char> receive() = 0;
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Transport over a SOCK_SEQPACKET socket, one message per packet. The ends can be used
+/// from different processes.
+///
+class MetaSocketTransport : public MetaTransport
+{
+    int m_socket;
+    vector<max_align_t> m_buffer;
+
+public:
+    explicit MetaSocketTransport(int socket)
+        : m_socket(socket)
+        , m_buffer(MetaWire::MaxMessageSize / sizeof(max_align_t))
+    {
+    }
+    ~MetaSocketTransport()
+    {
+        close(m_socket);
+    }
+    MetaSocketTransport(const MetaSocketTransport &) = delete;
+    MetaSocketTransport &operator =(const MetaSocketTransport &) = delete;
+
+    // two connected ends, null on failure
+    static pair<unique_ptr<MetaSocketTransport>, unique_ptr<MetaSocketTransport>> createPair()
+    {
+        int sockets[2];
+        if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockets) != 0) {
+            return {};
+        }
+        return { make_unique<MetaSocketTransport>(sockets[0]), make_unique<MetaSocketTransport>(sockets[1]) };
+    }
+
+    bool send(span<const char> message) override
+    {
+        if (message.size() > MetaWire::MaxMessageSize) {
+            return false;
+        }
+        ssize_t sent;
+        do {
+            sent = ::send(m_socket, message.data(), message.size(), MSG_NOSIGNAL);
+        } while (sent < 0 && errno == EINTR);
+        return sent == ssize_t(message.size());
+    }
+
+    span<char> receive() override
+    {
+        char *buffer = reinterpret_cast<char*>(m_buffer.data());
+        ssize_t received;
+        do {
+            received = recv(m_socket, buffer, MetaWire::MaxMessageSize, MSG_TRUNC);
+        } while (received < 0 && errno == EINTR);
+        if (received <= 0 || size_t(received) > MetaWire::MaxMessageSize) {
+            return span<char>();
+        }
+        return span<char>(buffer, size_t(received));
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Transport over a pair of single producer, single consumer rings in a shared memory
+/// mapping, which the processes forked after createPair() share. The messages are read
+/// in place from the ring; a message is released by the next receive(). Destroying a used
+/// end closes the connection, so a forked process can drop the end it does not use.
+///
+class MetaRingTransport : public MetaTransport
+{
+public:
+    static constexpr size_t Capacity = 256 * 1024;
+
+private:
+    // the record of a message; the payload follows, the records are 16 byte aligned
+    struct alignas(16) Record
+    {
+        uint32_t size;
+    };
+    // the rest of the ring is skipped
+    static constexpr uint32_t Wrap = 0xffffffff;
+
+    struct Ring
+    {
+        // the positions only grow, the offset in data is the position modulo Capacity
+        alignas(64) atomic<uint64_t> head = 0;
+        alignas(64) atomic<uint64_t> tail = 0;
+        alignas(64) atomic<bool> closed = false;
+        alignas(64) char data[Capacity];
+    };
+
+    struct Mapping
+    {
+        Ring *rings = nullptr;
+
+        Mapping()
+        {
+            void *memory = mmap(nullptr, 2 * sizeof(Ring), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (memory != MAP_FAILED) {
+                rings = static_cast<Ring*>(memory);
+                new (&rings[0]) Ring;
+                new (&rings[1]) Ring;
+            }
+        }
+        ~Mapping()
+        {
+            if (rings) {
+                munmap(rings, 2 * sizeof(Ring));
+            }
+        }
+    };
+
+    shared_ptr<Mapping> m_mapping;
+    Ring &m_out;
+    Ring &m_in;
+    // the position the last received message ends at
+    uint64_t m_release = 0;
+    bool m_used = false;
+
+    static size_t recordSize(size_t size)
+    {
+        return (sizeof(Record) + size + alignof(Record) - 1) & ~(alignof(Record) - 1);
+    }
+
+    // spins for a while before yielding, the other end usually answers within microseconds;
+    // false if the other end is closed before the condition holds
+    template<typename Condition>
+    bool wait(Condition condition) const
+    {
+        for (unsigned spins = 0; !condition(); ++spins) {
+            if (m_in.closed.load(memory_order_acquire)) {
+                // what the other end did before closing still counts
+                return condition();
+            }
+            if (spins > 1024) {
+                this_thread::yield();
+            }
+        }
+        return true;
+    }
+
+public:
+    MetaRingTransport(shared_ptr<Mapping> mapping, int index)
+        : m_mapping(move(mapping))
+        , m_out(m_mapping->rings[index])
+        , m_in(m_mapping->rings[1 - index])
+    {
+    }
+    ~MetaRingTransport()
+    {
+        if (m_used) {
+            m_out.closed.store(true, memory_order_release);
+        }
+    }
+    MetaRingTransport(const MetaRingTransport &) = delete;
+    MetaRingTransport &operator =(const MetaRingTransport &) = delete;
+
+    // two connected ends, null on failure
+    static pair<unique_ptr<MetaRingTransport>, unique_ptr<MetaRingTransport>> createPair()
+    {
+        shared_ptr<Mapping> mapping = make_shared<Mapping>();
+        if (!mapping->rings) {
+            return {};
+        }
+        return { make_unique<MetaRingTransport>(mapping, 0), make_unique<MetaRingTransport>(mapping, 1) };
+    }
+
+    bool send(span<const char> message) override
+    {
+        const size_t size = recordSize(message.size());
+        if (size > Capacity / 2 || m_in.closed.load(memory_order_acquire)) {
+            return false;
+        }
+        m_used = true;
+        uint64_t head = m_out.head.load(memory_order_relaxed);
+        const size_t offset = head % Capacity;
+        // the records are not split, the end of the ring is skipped instead
+        const size_t skip = Capacity - offset < size ? Capacity - offset : 0;
+        // the ring is full until the other end reads, which it does not once closed
+        if (!wait([&]() {
+                return head + skip + size - m_out.tail.load(memory_order_acquire) <= Capacity;
+            })) {
+            return false;
+        }
+        if (skip) {
+            reinterpret_cast<Record*>(m_out.data + offset)->size = Wrap;
+            head += skip;
+        }
+        Record *record = reinterpret_cast<Record*>(m_out.data + head % Capacity);
+        record->size = uint32_t(message.size());
+        memcpy(record + 1, message.data(), message.size());
+        m_out.head.store(head + size, memory_order_release);
+        return true;
+    }
+
+    span<char> receive() override
+    {
+        m_used = true;
+        uint64_t tail = m_release;
+        m_in.tail.store(tail, memory_order_release);
+        for (;;) {
+            if (!wait([&]() {
+                    return m_in.head.load(memory_order_acquire) != tail;
+                })) {
+                return span<char>();
+            }
+            Record *record = reinterpret_cast<Record*>(m_in.data + tail % Capacity);
+            if (record->size == Wrap) {
+                tail += Capacity - tail % Capacity;
+                continue;
+            }
+            m_release = tail + recordSize(record->size);
+            return span<char>(reinterpret_cast<char*>(record + 1), record->size);
+        }
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Serves the remote invokes on the registered objects. The arguments are passed to the
+/// methods straight from the received message, see MetaWire.
+///
+class MetaWireServer
+{
+    vector<MetaObject*> m_objects;
+    MetaWire::Writer m_writer;
+
+    MetaWire::Status invoke(MetaWire::Reader &request)
+    {
+        const MetaWire::Header &header = request.header();
+        if (header.object >= m_objects.size()) {
+            return MetaWire::NoObject;
+        }
+        MetaObject *object = m_objects[header.object];
+
+        if (header.argumentCount > MetaWire::MaxArguments) {
+            return MetaWire::NoMethod;
+        }
+        // the declared types, the return type first; they are checked before any value is
+        // read as them, the signature hash alone may collide
+        uint32_t types[MetaWire::MaxArguments + 1];
+        for (size_t t = 0; t <= header.argumentCount; ++t) {
+            if (!request.readWord(types[t])) {
+                return MetaWire::BadMessage;
+            }
+        }
+
+        MetaEpoch::Guard guard;
+        const MetaMethodRecord *method = nullptr;
+        MetaClass::MetaMethodRange range = object->metaObject()->methods(MetaSymbol::fromId(header.symbol));
+        for (MetaClass::MetaMethodIterator i = range.first; i != range.second; ++i) {
+            if ((*i)->signatureHash() == header.signatureHash && isDeclared(**i, types, header.argumentCount)) {
+                method = *i;
+                break;
+            }
+        }
+        if (!method) {
+            return MetaWire::NoMethod;
+        }
+
+        MetaValue slots[MetaWire::MaxArguments];
+        void *argv[MetaWire::MaxArguments + 1] = {};
+        // the values constructed in the slots are moved into the by-value parameters
+        uint64_t flags = 0;
+        for (int a = 0; a < method->argumentCount(); ++a) {
+            argv[a] = request.read(method->argumentsBegin()[a], slots[a]);
+            if (!argv[a]) {
+                return MetaWire::BadMessage;
+            }
+            if (argv[a] == slots[a].data()) {
+                flags |= uint64_t(1) << a;
+            }
+        }
+        if (!request.atEnd()) {
+            return MetaWire::BadMessage;
+        }
+
+        const arguments::ArgumentType &returnType = method->returnType();
+        if (returnType.typeId() == MetaType::Undefined) {
+            method->callPacked(object, nullptr, argv, flags);
+            return MetaWire::Ok;
+        }
+        MetaValue ret;
+        if (MetaWire::encoding(returnType) == MetaWire::Encoding::None) {
+            return MetaWire::NoMethod;
+        }
+        ret.construct(returnType.typeId(), [method, object, &argv, flags](void *storage) {
+            method->callPacked(object, storage, argv, flags | metainvoker::ConstructReturn);
+        });
+        m_writer.write(returnType, ret.data());
+        return MetaWire::Ok;
+    }
+
+    static bool isDeclared(const MetaMethodRecord &method, const uint32_t *types, size_t argumentCount)
+    {
+        if (size_t(method.argumentCount()) != argumentCount || method.returnType().m_value != types[0]) {
+            return false;
+        }
+        for (size_t a = 0; a < argumentCount; ++a) {
+            if (method.argumentsBegin()[a].m_value != types[a + 1]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+public:
+    // the id of the object in the requests
+    uint32_t add(MetaObject *object)
+    {
+        m_objects.push_back(object);
+        return uint32_t(m_objects.size() - 1);
+    }
+
+    // serves the next request of the transport; false once the transport is closed
+    bool serve(MetaTransport &transport)
+    {
+        span<char> message = transport.receive();
+        if (message.empty()) {
+            return false;
+        }
+        MetaWire::Reader request(message);
+        MetaWire::Header &response = m_writer.begin();
+        response = MetaWire::Header();
+        if (!request.isValid()) {
+            response.status = MetaWire::BadMessage;
+        } else {
+            response.callId = request.header().callId;
+            response.symbol = request.header().symbol;
+            response.signatureHash = request.header().signatureHash;
+            response.object = request.header().object;
+            const MetaWire::Status status = invoke(request);
+            if (status != MetaWire::Ok) {
+                // drop the partially written return value
+                MetaWire::Header failed = m_writer.header();
+                m_writer.begin() = failed;
+            }
+            m_writer.header().status = status;
+        }
+        return transport.send(m_writer.finish());
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////////////
+/// Invokes the methods of the objects of a MetaWireServer. The declared argument types
+/// of the remote method are given explicitly, they select the overload and the encoding:
+///
+///     int ret;
+///     client.call<int, int>(object, "intRetArgFunc", ret, 5);
+///
+/// post() and result() split the call, so that more calls can be on the way.
+///
+class MetaWireClient
+{
+    MetaTransport &m_transport;
+    MetaWire::Writer m_writer;
+    uint64_t m_callId = 0;
+
+public:
+    explicit MetaWireClient(MetaTransport &transport)
+        : m_transport(transport)
+    {
+    }
+
+    // sends the request without waiting for the response
+    template<typename TReturnType, typename... Arguments, typename... Values>
+    requires (sizeof...(Arguments) == sizeof...(Values))
+    bool post(uint32_t object, MetaSymbol name, Values &&...values)
+    {
+        static_assert(sizeof...(Arguments) <= MetaWire::MaxArguments, "too many arguments");
+        MetaWire::Header &header = m_writer.begin();
+        header = MetaWire::Header();
+        header.status = MetaWire::Request;
+        header.callId = ++m_callId;
+        header.symbol = name.id();
+        header.signatureHash = arguments::signatureHash<TReturnType, Arguments...>();
+        header.object = object;
+        m_writer.writeTypes<TReturnType, Arguments...>();
+        (m_writer.write<Arguments>(forward<Values>(values)), ...);
+        return m_transport.send(m_writer.finish());
+    }
+
+    // waits for the response of the oldest call posted; ret is null for void methods
+    template<typename TReturnType>
+    MetaWire::Status result(TReturnType *ret)
+    {
+        span<char> message = m_transport.receive();
+        MetaWire::Reader response(message);
+        if (message.empty()) {
+            return MetaWire::TransportError;
+        }
+        if (!response.isValid()) {
+            return MetaWire::BadMessage;
+        }
+        if (response.header().status != MetaWire::Ok) {
+            return response.header().status;
+        }
+        if constexpr (!is_void<TReturnType>::value) {
+            if (ret && !response.read(*ret)) {
+                return MetaWire::BadMessage;
+            }
+        }
+        if (ret && !response.atEnd()) {
+            return MetaWire::BadMessage;
+        }
+        return MetaWire::Ok;
+    }
+
+    template<typename TReturnType, typename... Arguments, typename... Values>
+    requires (sizeof...(Arguments) == sizeof...(Values) && !is_void<TReturnType>::value)
+    MetaWire::Status call(uint32_t object, MetaSymbol name, TReturnType &ret, Values &&...values)
+    {
+        if (!post<TReturnType, Arguments...>(object, name, forward<Values>(values)...)) {
+            return MetaWire::TransportError;
+        }
+        return result<TReturnType>(&ret);
+    }
+
+    template<typename TReturnType, typename... Arguments, typename... Values>
+    requires (sizeof...(Arguments) == sizeof...(Values))
+    MetaWire::Status call(uint32_t object, MetaSymbol name, Values &&...values)
+    {
+        if (!post<TReturnType, Arguments...>(object, name, forward<Values>(values)...)) {
+            return MetaWire::TransportError;
+        }
+        return result<TReturnType>(nullptr);
+    }
+};
+
+#endif // METAWIRE_H